@@ -0,0 +1,1002 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef BASICMAP_H_
+#define BASICMAP_H_
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "FirstTouch.h"
+
+/**
+ * growth policy: the region of elements grows toward both ends
+ * to contain written keys. (MimicMap)
+ */
+struct GrowBothEnds {
+  static constexpr bool kGrow = true;
+  static constexpr size_t kWindow = 0;
+};
+/**
+ * growth policy: the region of elements changes only by
+ * reserve/setLowerLimit/setHigherLimit,
+ * and writes out of the region are errors. (RigidMap)
+ */
+struct FixedRange {
+  static constexpr bool kGrow = false;
+  static constexpr size_t kWindow = 0;
+};
+/**
+ * growth policy: the region of elements grows like GrowBothEnds
+ * but keeps at most Width keys.
+ * writing a higher key discards the lowest keys,
+ * and writing a lower key exceeding Width is an error.
+ */
+template<size_t Width>
+struct SlidingWindow {
+  static_assert(Width > 0, "Width must be positive");
+  static constexpr bool kGrow = true;
+  static constexpr size_t kWindow = Width;
+};
+
+/**
+ * bounds policy: errors throw std::out_of_range.
+ */
+struct ThrowOnError {
+  static constexpr bool kChecked = true;
+  template<typename T>
+  using reference = T&;
+  template<typename T>
+  using value = T;
+  using status = void;
+  template<typename R, typename T>
+  static constexpr R ok(T&& result) {
+    return R(std::forward<T>(result));
+  }
+  static constexpr void succeeded() {}
+  template<typename R>
+  [[noreturn]] static constexpr R error(const char* what) {
+    throw std::out_of_range(what);
+  }
+};
+/**
+ * bounds policy: keys are not checked except by assert.
+ * accessing keys out of the region is undefined when NDEBUG.
+ */
+struct AssertOnly {
+  static constexpr bool kChecked = false;
+  template<typename T>
+  using reference = T&;
+  template<typename T>
+  using value = T;
+  using status = void;
+  template<typename R, typename T>
+  static constexpr R ok(T&& result) {
+    return R(std::forward<T>(result));
+  }
+  static constexpr void succeeded() {}
+  template<typename R>
+  [[noreturn]] static constexpr R error(const char* what) {
+    assert(!what);
+    (void)what;
+    std::abort();
+  }
+};
+/**
+ * bounds policy: errors are returned as std::nullopt or false,
+ * without exceptions.
+ * at() and operator[] return std::optional<std::reference_wrapper<V>>.
+ */
+struct ReturnOptional {
+  static constexpr bool kChecked = true;
+  template<typename T>
+  using reference = std::optional<std::reference_wrapper<T> >;
+  template<typename T>
+  using value = std::optional<T>;
+  using status = bool;
+  template<typename R, typename T>
+  static constexpr R ok(T&& result) {
+    return R(std::forward<T>(result));
+  }
+  static constexpr bool succeeded() {
+    return true;
+  }
+  template<typename R>
+  static constexpr R error(const char*) {
+    return R();
+  }
+};
+
+/**
+ * the sorted associative container based on std::vector,
+ * configured by policies.
+ *
+ * GrowthPolicy: GrowBothEnds, FixedRange or SlidingWindow<Width>.
+ * BoundsPolicy: ThrowOnError, AssertOnly or ReturnOptional.
+ * Storage: std::vector like sequence container of elements.
+ *
+ * key of the first element is cached,
+ * so that a lookup is a subtraction and a single unsigned comparison.
+ */
+template<typename K, typename V,
+         typename GrowthPolicy = GrowBothEnds,
+         typename BoundsPolicy = ThrowOnError,
+         typename Allocator = std::allocator<std::pair<K, V> >,
+         typename Storage = std::vector<std::pair<K, V>, Allocator> >
+class BasicMap {
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using iterator = typename Storage::iterator;
+  using const_iterator = typename Storage::const_iterator;
+  using reverse_iterator = typename Storage::reverse_iterator;
+  using const_reverse_iterator = typename Storage::const_reverse_iterator;
+  using allocator_type = Allocator;
+  using growth_policy = GrowthPolicy;
+  using bounds_policy = BoundsPolicy;
+  /**
+   * result type of at() and operator[].
+   */
+  using mapped_reference =
+    typename BoundsPolicy::template reference<V>;
+  using const_mapped_reference =
+    typename BoundsPolicy::template reference<const V>;
+  /**
+   * result type of insert().
+   */
+  using insert_result =
+    typename BoundsPolicy::template value<std::pair<iterator, bool> >;
+  /**
+   * result type of operations which may fail.
+   */
+  using status = typename BoundsPolicy::status;
+  /**
+   * constructs an empty container.
+   */
+  constexpr explicit BasicMap(
+    const allocator_type& allocator = allocator_type())
+    : elements(allocator), base(),
+      hasLowerLimit(false), hasHigherLimit(false),
+      lowerLimit(), higherLimit() {}
+  /**
+   * copy constructor.
+   */
+  constexpr BasicMap(const BasicMap& orig)
+    : elements(orig.elements), base(orig.base),
+      hasLowerLimit(orig.hasLowerLimit),
+      hasHigherLimit(orig.hasHigherLimit),
+      lowerLimit(orig.lowerLimit),
+      higherLimit(orig.higherLimit) {
+  }
+  /**
+   * move constructor.
+   */
+  constexpr BasicMap(BasicMap&& orig) noexcept
+    : elements(std::move(orig.elements)), base(orig.base),
+      hasLowerLimit(orig.hasLowerLimit),
+      hasHigherLimit(orig.hasHigherLimit),
+      lowerLimit(orig.lowerLimit),
+      higherLimit(orig.higherLimit) {
+  }
+  /**
+   * copy constructor with allocator.
+   */
+  constexpr BasicMap(const BasicMap& orig, const allocator_type& allocator)
+    : elements(orig.elements, allocator), base(orig.base),
+      hasLowerLimit(orig.hasLowerLimit),
+      hasHigherLimit(orig.hasHigherLimit),
+      lowerLimit(orig.lowerLimit),
+      higherLimit(orig.higherLimit) {
+  }
+  /**
+   * constructs with the contents of the range [first, last).
+   * keys of the range must be consecutive and sorted.
+   */
+  template<typename IT>
+  constexpr BasicMap(IT first, IT last,
+                     const allocator_type& allocator = allocator_type())
+    : elements(first, last, allocator), base(),
+      hasLowerLimit(false), hasHigherLimit(false),
+      lowerLimit(), higherLimit() {
+    if (!elements.empty()) {
+      base = elements.begin()->first;
+    }
+  }
+  /**
+   * copy assign operator.
+   */
+  constexpr BasicMap& operator=(const BasicMap& orig) {
+    elements = orig.elements;
+    base = orig.base;
+    hasLowerLimit = orig.hasLowerLimit;
+    hasHigherLimit = orig.hasHigherLimit;
+    lowerLimit = orig.lowerLimit;
+    higherLimit = orig.higherLimit;
+    return *this;
+  }
+  /**
+   * move assign operator.
+   */
+  constexpr BasicMap& operator=(BasicMap&& orig) {
+    elements = std::move(orig.elements);
+    base = orig.base;
+    hasLowerLimit = orig.hasLowerLimit;
+    hasHigherLimit = orig.hasHigherLimit;
+    lowerLimit = orig.lowerLimit;
+    higherLimit = orig.higherLimit;
+    return *this;
+  }
+  /**
+   * swaps the contents.
+   */
+  constexpr void swap(BasicMap& other) {
+    std::swap(elements, other.elements);
+    std::swap(base, other.base);
+    std::swap(hasLowerLimit, other.hasLowerLimit);
+    std::swap(hasHigherLimit, other.hasHigherLimit);
+    std::swap(lowerLimit, other.lowerLimit);
+    std::swap(higherLimit, other.higherLimit);
+  }
+  /**
+   * returns the associated allocator.
+   */
+  constexpr allocator_type get_allocator() const {
+    return elements.get_allocator();
+  }
+  /**
+   * returns the number of elements.
+   * same as the number from minimum key to maximum key.
+   */
+  constexpr size_t size() const {
+    return elements.size();
+  }
+  /**
+   * allocate elements.
+   * an empty container stays empty if high < low.
+   * returns false instead of throwing if ReturnOptional.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  constexpr status reserve(const K& low,
+                           const K& high) {
+    if (elements.empty()) {
+      return result(assignChecked(low, high, nullptr));
+    }
+    return result(expand(low, high, nullptr));
+  }
+  /**
+   * allocate elements.
+   * pages of elements are placed on NUMA nodes
+   * by worker threads according to policy.
+   * an empty container stays empty if high < low.
+   * returns false instead of throwing if ReturnOptional.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  constexpr status reserve(const K& low,
+                           const K& high,
+                           const FirstTouchPolicy& policy) {
+    if (elements.empty()) {
+      return result(assignChecked(low, high, &policy));
+    }
+    return result(expand(low, high, &policy));
+  }
+  /**
+   * set lower limit of keys.
+   * removes lower key entries if exists.
+   * if FixedRange, the region of elements starts from given key.
+   */
+  constexpr BasicMap& setLowerLimit(const K& key) {
+    if constexpr (!GrowthPolicy::kGrow) {
+      if (elements.empty() || elements.rbegin()->first < key) {
+        elements.clear();
+        assign(key, key, nullptr);
+        return *this;
+      }
+      if (key < base) {
+        expand(key, elements.rbegin()->first, nullptr);
+      }
+    } else {
+      lowerLimit = key;
+      hasLowerLimit = true;
+      if (elements.empty()) {
+        return *this;
+      }
+      if (elements.rbegin()->first < key) {
+        elements.clear();
+        return *this;
+      }
+    }
+    if (base < key) {
+      elements.erase(elements.begin(), elements.begin() + (key - base));
+      base = key;
+      assert(elements.begin()->first == key);
+    }
+    return *this;
+  }
+  /**
+   * set higher limit of keys.
+   * removes higher key entries if exists.
+   * if FixedRange, the region of elements ends at given key.
+   */
+  constexpr BasicMap& setHigherLimit(const K& key) {
+    if constexpr (!GrowthPolicy::kGrow) {
+      if (elements.empty() || key < base) {
+        elements.clear();
+        assign(key, key, nullptr);
+        return *this;
+      }
+      if (elements.rbegin()->first < key) {
+        pile(key);
+      }
+    } else {
+      higherLimit = key;
+      hasHigherLimit = true;
+      if (elements.empty()) {
+        return *this;
+      }
+      if (key < base) {
+        elements.clear();
+        return *this;
+      }
+    }
+    if (key < elements.rbegin()->first) {
+      elements.resize(key - base + 1);
+      assert(elements.rbegin()->first == key);
+    }
+    return *this;
+  }
+  /**
+   * clears the contents.
+   */
+  constexpr void clear() {
+    elements.clear();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  constexpr iterator begin() {
+    return elements.begin();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  constexpr const_iterator begin() const {
+    return cbegin();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  constexpr const_iterator cbegin() const {
+    return elements.begin();
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  constexpr iterator end() {
+    return elements.end();
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  constexpr const_iterator end() const {
+    return cend();
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  constexpr const_iterator cend() const {
+    return elements.end();
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  constexpr reverse_iterator rbegin() {
+    return elements.rbegin();
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  constexpr const_reverse_iterator rbegin() const {
+    return crbegin();
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  constexpr const_reverse_iterator crbegin() const {
+    return elements.rbegin();
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  constexpr reverse_iterator rend() {
+    return elements.rend();
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  constexpr const_reverse_iterator rend() const {
+    return crend();
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  constexpr const_reverse_iterator crend() const {
+    return elements.rend();
+  }
+  /**
+   * checks whether the container is empty.
+   */
+  constexpr bool empty() const {
+    return elements.empty();
+  }
+  /**
+   * returns the number of elements matching specific key.
+   */
+  template <typename Key>
+  constexpr size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  /**
+   * checks if the container contains element with specific key.
+   */
+  template <typename Key>
+  constexpr bool contains(const Key& key) const {
+    return offset(key) < elements.size();
+  }
+  /**
+   * inserts element.
+   *
+   * returns a pair consisting of an iterator to the element
+   * (inserted or updated) and a bool denoting
+   * whether inserted or not.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  constexpr insert_result insert(const value_type& value) {
+    const K key = value.first;
+    size_t i = offset(key);
+    bool inserted = false;
+    if (!(i < elements.size())) {
+      if (const char* what = grow(key)) {
+        return BoundsPolicy::template error<insert_result>(what);
+      }
+      i = offset(key);
+      inserted = true;
+    }
+    iterator iter = elements.begin() + i;
+    assert(iter->first == key);
+    iter->second = value.second;
+    return BoundsPolicy::template ok<insert_result>(
+      std::make_pair(iter, inserted));
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  constexpr iterator find(const Key& key) {
+    const size_t i = offset(key);
+    if (!(i < elements.size())) {
+      return end();
+    }
+    return elements.begin() + i;
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  constexpr const_iterator find(const Key& key) const {
+    const size_t i = offset(key);
+    if (!(i < elements.size())) {
+      return end();
+    }
+    return elements.begin() + i;
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  constexpr mapped_reference at(const Key& key) {
+    const size_t i = offset(key);
+    if constexpr (BoundsPolicy::kChecked) {
+      if (!(i < elements.size())) {
+        return BoundsPolicy::template error<mapped_reference>(
+          "key not found");
+      }
+    }
+    assert(i < elements.size());
+    return BoundsPolicy::template ok<mapped_reference>(elements[i].second);
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  constexpr const_mapped_reference at(const Key& key) const {
+    const size_t i = offset(key);
+    if constexpr (BoundsPolicy::kChecked) {
+      if (!(i < elements.size())) {
+        return BoundsPolicy::template error<const_mapped_reference>(
+          "key not found");
+      }
+    }
+    assert(i < elements.size());
+    return BoundsPolicy::template ok<const_mapped_reference>(
+      elements[i].second);
+  }
+  /**
+   * access or insert specified element.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  template <typename Key>
+  constexpr mapped_reference operator[](const Key& key) {
+    size_t i = offset(key);
+    if (GrowthPolicy::kGrow || BoundsPolicy::kChecked) {
+      if (!(i < elements.size())) {
+        if (const char* what = grow(key)) {
+          return BoundsPolicy::template error<mapped_reference>(what);
+        }
+        i = offset(key);
+      }
+    }
+    assert(i < elements.size());
+    return BoundsPolicy::template ok<mapped_reference>(elements[i].second);
+  }
+  /**
+   * merges elements of other container.
+   *
+   * the region of elements is expanded at once to cover other container.
+   * elements of keys in both containers are combined
+   * as op(this value, other value), and others are copied.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  template <typename BinaryOp>
+  constexpr status mergeWith(const BasicMap& other, BinaryOp op) {
+    return result(mergeElements(other, op));
+  }
+
+ private:
+  /**
+   * wrapped std::vector
+   */
+  Storage elements;
+  /**
+   * key of the first element.
+   */
+  K base;
+  bool hasLowerLimit;
+  bool hasHigherLimit;
+  K lowerLimit;
+  K higherLimit;
+
+  /**
+   * merges elements of other container.
+   * returns error message if failed.
+   */
+  template <typename BinaryOp>
+  constexpr const char* mergeElements(const BasicMap& other, BinaryOp op) {
+    if (other.elements.empty()) {
+      return nullptr;
+    }
+    const K otherMin = other.base;
+    const K otherMax = other.elements.rbegin()->first;
+    if (elements.empty()) {
+      if (const char* what = growable(otherMin, otherMax)) {
+        return what;
+      }
+      elements = other.elements;
+      base = other.base;
+      return nullptr;
+    }
+    const K minKey = base;
+    const K maxKey = elements.rbegin()->first;
+    if (otherMin < minKey || maxKey < otherMax) {
+      if (const char* what = growable(otherMin, otherMax)) {
+        return what;
+      }
+      if (const char* what = expand(otherMin, otherMax, nullptr)) {
+        return what;
+      }
+    }
+    merge(other, minKey, maxKey, op);
+    return nullptr;
+  }
+  /**
+   * returns the offset of the element of given key from the first.
+   * keys out of the region result in offsets not less than size().
+   */
+  template <typename Key>
+  constexpr size_t offset(const Key& key) const {
+    if constexpr (std::is_integral<Key>::value &&
+                  std::is_integral<K>::value) {
+      using C = typename std::common_type<Key, K>::type;
+      using U = typename std::make_unsigned<C>::type;
+      const U i = static_cast<U>(static_cast<U>(static_cast<C>(key)) -
+                                 static_cast<U>(static_cast<C>(base)));
+      if constexpr (sizeof(U) > sizeof(size_t)) {
+        return i < elements.size() ? static_cast<size_t>(i) : size_t(-1);
+      } else {
+        return static_cast<size_t>(i);
+      }
+    } else {
+      if (elements.empty() || key < base) {
+        return size_t(-1);
+      }
+      return static_cast<size_t>(key - base);
+    }
+  }
+  constexpr status result(const char* what) {
+    if (what != nullptr) {
+      return BoundsPolicy::template error<status>(what);
+    }
+    return BoundsPolicy::succeeded();
+  }
+  /**
+   * checks limits of keys. returns error message if exceeded.
+   */
+  constexpr const char* checkLimits(const K& low, const K& high) const {
+    const bool lower = hasLowerLimit && low < lowerLimit;
+    const bool higher = hasHigherLimit && high > higherLimit;
+    if constexpr (BoundsPolicy::kChecked) {
+      if (lower) {
+        return "lower limit exceeded";
+      }
+      if (higher) {
+        return "higher limit exceeded";
+      }
+    }
+    assert(!lower && !higher);
+    (void)lower;
+    (void)higher;
+    return nullptr;
+  }
+  /**
+   * checks whether [low, high] fits in SlidingWindow.
+   * returns error message if not.
+   */
+  constexpr const char* fitsWindow(const K& low, const K& high) const {
+    if constexpr (GrowthPolicy::kWindow > 0) {
+      const bool exceeded =
+        static_cast<size_t>(high - low) >= GrowthPolicy::kWindow;
+      if constexpr (BoundsPolicy::kChecked) {
+        if (exceeded) {
+          return "window exceeded";
+        }
+      }
+      assert(!exceeded);
+      (void)exceeded;
+    }
+    (void)low;
+    (void)high;
+    return nullptr;
+  }
+  /**
+   * checks whether the region of elements may grow to [low, high].
+   * returns error message if not.
+   */
+  constexpr const char* growable(const K& low, const K& high) const {
+    if constexpr (!GrowthPolicy::kGrow) {
+      if (elements.empty()) {
+        return "empty map";
+      }
+      if (low < base) {
+        return "lower limit exceeded";
+      }
+      if (high > elements.rbegin()->first) {
+        return "higher limit exceeded";
+      }
+    }
+    return checkLimits(low, high);
+  }
+  /**
+   * expand the region of elements to contain given key.
+   * returns error message if failed.
+   */
+  constexpr const char* grow(const K& key) {
+    if (const char* what = growable(key, key)) {
+      return what;
+    }
+    if (elements.empty()) {
+      assign(key, key, nullptr);
+      return nullptr;
+    }
+    if (key < base) {
+      return dig(key);
+    }
+    return pile(key);
+  }
+  /**
+   * allocate elements of empty container, none if high < low.
+   */
+  constexpr void assign(const K& low, const K& high,
+                        const FirstTouchPolicy* policy) {
+    if (high < low) {
+      return;
+    }
+    base = low;
+    if (policy != nullptr) {
+      Storage storage(elements.get_allocator());
+      construct(storage, static_cast<size_t>(high - low) + 1, *policy,
+                [&](size_t i) {
+                  return value_type(static_cast<K>(low + i), V());
+                });
+      elements = std::move(storage);
+      return;
+    }
+    elements.reserve(high - low + 1);
+    for (K i = low; i <= high; ++i) {
+      // elements.push_back(std::make_pair(i, V()));
+      elements.emplace_back(i, V());
+    }
+  }
+  /**
+   * fills empty storage with n elements, the i-th of which is make(i).
+   * worker threads pinned according to policy construct elements
+   * on their own pages, so that the first touch places the pages.
+   * an element belongs to the part of its first byte.
+   * storage with append() is built in parallel in place;
+   * others are filled by emplace_back() taking turns in order.
+   */
+  template<typename F>
+  static void construct(Storage& storage, size_t n,
+                        const FirstTouchPolicy& policy, F make) {
+    constexpr size_t size = sizeof(value_type);
+    if constexpr (first_touch::HasAppend<Storage>::value) {
+      storage.append(n, [&](value_type* data) {
+          std::mutex mutex;
+          // parts already built, to destroy if another part fails.
+          std::vector<std::pair<size_t, size_t>> built;
+          try {
+            firstTouch(data, n * size, policy,
+                       [&](size_t first, size_t last) {
+                         const size_t from = (first + size - 1) / size;
+                         const size_t to = (last + size - 1) / size;
+                         size_t i = from;
+                         try {
+                           for (; i < to; ++i) {
+                             ::new(static_cast<void*>(data + i))
+                               value_type(make(i));
+                           }
+                         } catch (...) {
+                           std::destroy(data + from, data + i);
+                           throw;
+                         }
+                         std::lock_guard<std::mutex> lock(mutex);
+                         built.emplace_back(from, to);
+                       });
+          } catch (...) {
+            for (const std::pair<size_t, size_t>& part : built) {
+              std::destroy(data + part.first, data + part.second);
+            }
+            throw;
+          }
+        });
+    } else {
+      // std::vector cannot adopt elements built out of order,
+      // so the workers append their parts one after another.
+      storage.reserve(n);
+      firstTouch(storage.data(), n * size, policy,
+                 [&](size_t first, size_t last) {
+                   for (size_t i = (first + size - 1) / size;
+                        i * size < last; ++i) {
+                     storage.emplace_back(make(i));
+                   }
+                 }, true);
+    }
+  }
+  /**
+   * allocate elements of empty container within limits.
+   * returns error message if failed.
+   */
+  constexpr const char* assignChecked(const K& low, const K& high,
+                                      const FirstTouchPolicy* policy) {
+    if (high < low) {
+      return nullptr;
+    }
+    if (const char* what = checkLimits(low, high)) {
+      return what;
+    }
+    if (const char* what = fitsWindow(low, high)) {
+      return what;
+    }
+    assign(low, high, policy);
+    return nullptr;
+  }
+  /**
+   * expand the region of elements forward given key.
+   */
+  constexpr const char* dig(const K& key) {
+    return expand(key, elements.rbegin()->first, nullptr);
+  }
+  /**
+   * expand the region of elements to contain [low, high]
+   * with single allocation.
+   * if policy is given, always reallocates to place pages by policy.
+   * returns error message if failed.
+   */
+  constexpr const char* expand(const K& low, const K& high,
+                               const FirstTouchPolicy* policy) {
+    const K minKey = base;
+    const K maxKey = elements.rbegin()->first;
+    if (!(low < minKey) && (policy == nullptr || !(maxKey < high))) {
+      if (maxKey < high) {
+        return pile(high);
+      }
+      return nullptr;
+    }
+    const K bottom = low < minKey ? low : minKey;
+    const K top = maxKey < high ? high : maxKey;
+    if (const char* what = checkLimits(bottom, top)) {
+      return what;
+    }
+    if (const char* what = fitsWindow(bottom, top)) {
+      return what;
+    }
+    Storage elements2(elements.get_allocator());
+    if (policy != nullptr) {
+      construct(elements2, static_cast<size_t>(top - bottom) + 1, *policy,
+                [&](size_t i) {
+                  const K key = static_cast<K>(bottom + i);
+                  return key < minKey || maxKey < key ?
+                    value_type(key, V()) :
+                    elements[static_cast<size_t>(key - minKey)];
+                });
+      elements = std::move(elements2);
+      base = bottom;
+      return nullptr;
+    }
+    elements2.reserve(top - bottom + 1);
+    for (K i = bottom; i < minKey; ++i) {
+      // elements2.push_back(std::make_pair(i, V()));
+      elements2.emplace_back(i, V());
+    }
+    for (iterator
+           iter = elements.begin(); iter != elements.end(); ++iter) {
+      // elements2.push_back(*iter);
+      elements2.emplace_back(*iter);
+    }
+    for (K i = maxKey + 1; i <= top; ++i) {
+      elements2.emplace_back(i, V());
+    }
+    elements = std::move(elements2);
+    base = bottom;
+    return nullptr;
+  }
+  /**
+   * expand the region of elements toward given key.
+   * returns error message if failed.
+   */
+  constexpr const char* pile(const K& key) {
+    if (const char* what = checkLimits(base, key)) {
+      return what;
+    }
+    K maxKey = elements.rbegin()->first;
+    if constexpr (GrowthPolicy::kWindow > 0) {
+      // discards the lowest keys to keep Width keys.
+      const K low = static_cast<K>(key - (GrowthPolicy::kWindow - 1));
+      if (maxKey < low) {
+        elements.clear();
+        assign(low, key, nullptr);
+        return nullptr;
+      }
+      if (base < low) {
+        elements.erase(elements.begin(), elements.begin() + (low - base));
+        base = low;
+      }
+    }
+    for (K i = maxKey + 1; i <= key; ++i) {
+      // elements.push_back(std::make_pair(i, V()));
+      elements.emplace_back(i, V());
+    }
+    return nullptr;
+  }
+  /**
+   * merges elements of other container already covered by this.
+   * keys in [low, high] are combined by op, and others are copied.
+   */
+  template <typename BinaryOp>
+  constexpr void merge(const BasicMap& other,
+                       const K& low, const K& high, BinaryOp op) {
+    const K otherMin = other.base;
+    const K otherMax = other.elements.rbegin()->first;
+    const value_type* src = other.elements.data();
+    value_type* dst = elements.data() + (otherMin - base);
+    const size_t n = other.elements.size();
+    // [0, head) copied, [head, tail) combined, [tail, n) copied.
+    size_t head = 0;
+    size_t tail = 0;
+    if (!(high < otherMin) && !(otherMax < low)) {
+      head = otherMin < low ? static_cast<size_t>(low - otherMin) : 0;
+      tail = otherMax > high ? static_cast<size_t>(high - otherMin) + 1 : n;
+    } else if (otherMax < low) {
+      head = tail = n;
+    }
+    for (size_t i = 0; i < head; ++i) {
+      dst[i].second = src[i].second;
+    }
+    for (size_t i = head; i < tail; ++i) {
+      dst[i].second = op(dst[i].second, src[i].second);
+    }
+    for (size_t i = tail; i < n; ++i) {
+      dst[i].second = src[i].second;
+    }
+  }
+  template <typename K2, typename V2, typename G2, typename B2,
+            typename A2, typename S2, typename BinaryOp>
+  friend typename B2::template value<BasicMap<K2, V2, G2, B2, A2, S2> >
+  combine(
+      const BasicMap<K2, V2, G2, B2, A2, S2>& a,
+      const BasicMap<K2, V2, G2, B2, A2, S2>& b,
+      BinaryOp op);
+};
+/**
+ * returns a new container merging elements of two containers.
+ * same as copying a and mergeWith(b, op)
+ * but allocates elements only once.
+ *
+ * exceptions:
+ *   std::out_of_range if key exceeds limits of a.
+ */
+template <typename K, typename V, typename GrowthPolicy,
+          typename BoundsPolicy, typename Allocator, typename Storage,
+          typename BinaryOp>
+typename BoundsPolicy::template value<
+  BasicMap<K, V, GrowthPolicy, BoundsPolicy, Allocator, Storage> > combine(
+    const BasicMap<K, V, GrowthPolicy, BoundsPolicy, Allocator, Storage>& a,
+    const BasicMap<K, V, GrowthPolicy, BoundsPolicy, Allocator, Storage>& b,
+    BinaryOp op) {
+  using Map = BasicMap<K, V, GrowthPolicy, BoundsPolicy, Allocator, Storage>;
+  using Result = typename BoundsPolicy::template value<Map>;
+  if (a.empty() || b.empty() ||
+      (!(b.base < a.base) &&
+       !(a.elements.rbegin()->first < b.elements.rbegin()->first))) {
+    Map result(a, a.get_allocator());
+    if (const char* what = result.mergeElements(b, op)) {
+      return BoundsPolicy::template error<Result>(what);
+    }
+    return BoundsPolicy::template ok<Result>(std::move(result));
+  }
+  const K aMin = a.base;
+  const K aMax = a.elements.rbegin()->first;
+  const K bMin = b.base;
+  const K bMax = b.elements.rbegin()->first;
+  const K low = aMin < bMin ? aMin : bMin;
+  const K high = aMax < bMax ? bMax : aMax;
+  if (const char* what = a.growable(low, high)) {
+    return BoundsPolicy::template error<Result>(what);
+  }
+  if (const char* what = a.fitsWindow(low, high)) {
+    return BoundsPolicy::template error<Result>(what);
+  }
+  Map result(a.get_allocator());
+  result.hasLowerLimit = a.hasLowerLimit;
+  result.hasHigherLimit = a.hasHigherLimit;
+  result.lowerLimit = a.lowerLimit;
+  result.higherLimit = a.higherLimit;
+  result.assign(low, high, nullptr);
+  typename Map::value_type* dst = result.elements.data() + (aMin - low);
+  for (size_t i = 0; i < a.elements.size(); ++i) {
+    dst[i].second = a.elements[i].second;
+  }
+  result.merge(b, aMin, aMax, op);
+  return BoundsPolicy::template ok<Result>(std::move(result));
+}
+#endif  // BASICMAP_H_
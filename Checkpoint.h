@@ -0,0 +1,636 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "MimicMap.h"
+#include "Serialize.h"
+
+/**
+ * checkpoint log format.
+ *
+ * a log is a sequence of records:
+ *   uint32_t magic, uint32_t type (kBase or kDelta),
+ *   uint64_t size (the number of elements),
+ *   K low (the minimum key, only if size > 0),
+ *   uint64_t pages,
+ *   pages times of { K first, uint64_t n, V values[n] }.
+ * a kBase record has all elements in one page.
+ * a kDelta record has pages changed since the previous record.
+ * values are stored in native byte order.
+ */
+namespace checkpoint {
+static constexpr uint32_t kMagic = 0x50434d4d;  // "MMCP"
+static constexpr uint32_t kBase = 0;
+static constexpr uint32_t kDelta = 1;
+
+using serialize::put;
+/**
+ * buffered reader of a log.
+ */
+class Reader {
+ public:
+  explicit Reader(int file)
+    : fd(file), buffer(64 * 1024), pos(0), end(0) {}
+  /**
+   * reads n bytes to p. returns false if the log ends.
+   */
+  bool read(void* p, size_t n) {
+    char* out = static_cast<char*>(p);
+    while (n > 0) {
+      if (pos == end) {
+        if (n >= buffer.size()) {
+          // reads large pages directly.
+          return readAll(out, n);
+        }
+        if (!fill()) {
+          return false;
+        }
+      }
+      const size_t k = std::min(n, end - pos);
+      std::memcpy(out, &buffer[pos], k);
+      pos += k;
+      out += k;
+      n -= k;
+    }
+    return true;
+  }
+
+ private:
+  int fd;
+  std::vector<char> buffer;
+  size_t pos;
+  size_t end;
+
+  bool fill() {
+    const ssize_t n = ::read(fd, buffer.data(), buffer.size());
+    if (n <= 0) {
+      return false;
+    }
+    pos = 0;
+    end = static_cast<size_t>(n);
+    return true;
+  }
+  bool readAll(char* p, size_t rest) {
+    while (rest > 0) {
+      const ssize_t n = ::read(fd, p, rest);
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      rest -= n;
+    }
+    return true;
+  }
+};
+template<typename T>
+bool get(Reader* in, T* value) {
+  return in->read(value, sizeof(T));
+}
+inline void writeAll(int fd, const std::vector<char>& data) {
+  serialize::writeAll(fd, data.data(), data.size());
+}
+/**
+ * appends a record header.
+ */
+template<typename K, typename V>
+void header(std::vector<char>* out, uint32_t type,
+            const MimicMap<K, V>& m, uint64_t pages) {
+  put(out, kMagic);
+  put(out, type);
+  put(out, static_cast<uint64_t>(m.size()));
+  if (!m.empty()) {
+    put(out, m.begin()->first);
+  }
+  put(out, pages);
+}
+/**
+ * appends a page of elements [first, first + n).
+ */
+template<typename K, typename V>
+void page(std::vector<char>* out, const MimicMap<K, V>& m,
+          const K& first, uint64_t n) {
+  put(out, first);
+  put(out, n);
+  for (typename MimicMap<K, V>::const_iterator
+         iter = m.find(first); n > 0; --n, ++iter) {
+    put(out, iter->second);
+  }
+}
+/**
+ * changes the region of elements to [low, low + size).
+ */
+template<typename K, typename V>
+void resize(MimicMap<K, V>* m, const K& low, uint64_t size) {
+  if (size == 0) {
+    m->clear();
+    return;
+  }
+  const K high = static_cast<K>(low + (size - 1));
+  if (m->empty() ||
+      (!(low > m->begin()->first) && !(high < m->rbegin()->first))) {
+    m->reserve(low, high);
+    return;
+  }
+  MimicMap<K, V> next;
+  next.reserve(low, high);
+  for (const typename MimicMap<K, V>::value_type& e : *m) {
+    if (next.contains(e.first)) {
+      next.at(e.first) = e.second;
+    }
+  }
+  m->swap(next);
+}
+}  // namespace checkpoint
+
+/**
+ * loads MimicMap from checkpoint log written by CheckpointedMap.
+ * an incomplete last record is ignored.
+ *
+ * exceptions:
+ *   std::system_error if the log cannot be opened.
+ */
+template<typename K, typename V>
+MimicMap<K, V> loadCheckpoint(const std::string& path) {
+  static_assert(std::is_trivially_copyable<K>::value &&
+                std::is_trivially_copyable<V>::value,
+                "K and V must be trivially copyable");
+  MimicMap<K, V> m;
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  // bytes left in the log, which bound the size of a page.
+  const off_t length = ::lseek(fd, 0, SEEK_END);
+  uint64_t rest = length > 0 ? static_cast<uint64_t>(length) : 0;
+  ::lseek(fd, 0, SEEK_SET);
+  checkpoint::Reader in(fd);
+  for (;;) {
+    uint32_t magic = 0;
+    uint32_t type = 0;
+    uint64_t size = 0;
+    K low = K();
+    uint64_t pages = 0;
+    if (!checkpoint::get(&in, &magic) || magic != checkpoint::kMagic ||
+        !checkpoint::get(&in, &type) || !checkpoint::get(&in, &size) ||
+        (size > 0 && !checkpoint::get(&in, &low)) ||
+        !checkpoint::get(&in, &pages)) {
+      break;
+    }
+    rest -= std::min<uint64_t>(rest, 2 * sizeof(uint32_t) +
+                               2 * sizeof(uint64_t) +
+                               (size > 0 ? sizeof(K) : 0));
+    // reads whole record before applying it.
+    std::vector<std::pair<K, std::vector<V> > > record;
+    bool complete = pages <= rest / (sizeof(K) + sizeof(uint64_t));
+    for (uint64_t p = 0; complete && p < pages; ++p) {
+      K first = K();
+      uint64_t n = 0;
+      complete = checkpoint::get(&in, &first) && checkpoint::get(&in, &n);
+      rest -= std::min<uint64_t>(rest, sizeof(K) + sizeof(uint64_t));
+      complete = complete && n <= rest / sizeof(V);
+      if (complete) {
+        record.emplace_back(first, std::vector<V>(n));
+        complete = in.read(record.back().second.data(), n * sizeof(V));
+        rest -= n * sizeof(V);
+      }
+    }
+    if (!complete) {
+      break;
+    }
+    if (type == checkpoint::kBase) {
+      m.clear();
+    }
+    checkpoint::resize(&m, low, size);
+    for (const std::pair<K, std::vector<V> >& page : record) {
+      typename MimicMap<K, V>::iterator iter = m.find(page.first);
+      for (const V& value : page.second) {
+        (iter++)->second = value;
+      }
+    }
+  }
+  ::close(fd);
+  return m;
+}
+
+/**
+ * MimicMap with incremental checkpointing to a log file.
+ *
+ * writes through operator[], insert and at() mark pages of
+ * PageSlots keys dirty. checkpoint() copies only dirty pages
+ * and the current region of elements, and a background thread
+ * appends them to the log. compact() replaces the log with
+ * a snapshot of all elements.
+ * limits of keys are not saved.
+ */
+template<typename K, typename V,
+         size_t PageSlots = (sizeof(std::pair<K, V>) < 4096 ?
+                             4096 / sizeof(std::pair<K, V>) : 1)>
+class CheckpointedMap {
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(std::is_trivially_copyable<V>::value,
+                "V must be trivially copyable");
+
+ public:
+  using map_type = MimicMap<K, V>;
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = typename map_type::value_type;
+  using iterator = typename map_type::iterator;
+  using const_iterator = typename map_type::const_iterator;
+  /**
+   * opens checkpoint log, restoring elements saved in it.
+   * interval > 0 compacts the log every interval checkpoints.
+   *
+   * exceptions:
+   *   std::system_error if the log cannot be opened.
+   */
+  explicit CheckpointedMap(const std::string& file, size_t interval = 0)
+    : path(file), compactInterval(interval), checkpoints(0),
+      anchor(), hasAnchor(false), firstPage(0), cleared(false),
+      fd(-1), stopping(false), writing(false) {
+    if (::access(path.c_str(), F_OK) == 0) {
+      m = loadCheckpoint<K, V>(path);
+    }
+    if (!m.empty()) {
+      anchor = m.begin()->first;
+      hasAnchor = true;
+    }
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    writer = std::thread([this]() { run(); });
+  }
+  CheckpointedMap(const CheckpointedMap&) = delete;
+  CheckpointedMap& operator=(const CheckpointedMap&) = delete;
+  /**
+   * writes queued checkpoints and closes the log.
+   * elements changed after the last checkpoint are not written.
+   */
+  ~CheckpointedMap() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    writer.join();
+    ::close(fd);
+  }
+  /**
+   * returns the wrapped container.
+   */
+  const map_type& map() const {
+    return m;
+  }
+  size_t size() const {
+    return m.size();
+  }
+  bool empty() const {
+    return m.empty();
+  }
+  const_iterator begin() const {
+    return m.begin();
+  }
+  const_iterator end() const {
+    return m.end();
+  }
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return m.count(key);
+  }
+  template <typename Key>
+  bool contains(const Key& key) const {
+    return m.contains(key);
+  }
+  template <typename Key>
+  const_iterator find(const Key& key) const {
+    return m.find(key);
+  }
+  template <typename Key>
+  const V& at(const Key& key) const {
+    return m.at(key);
+  }
+  /**
+   * access specified element with bounds checking,
+   * marking it dirty.
+   */
+  template <typename Key>
+  V& at(const Key& key) {
+    V& value = m.at(key);
+    mark(static_cast<K>(key));
+    return value;
+  }
+  /**
+   * access or insert specified element, marking it dirty.
+   */
+  template <typename Key>
+  V& operator[](const Key& key) {
+    V& value = m[key];
+    mark(static_cast<K>(key));
+    return value;
+  }
+  /**
+   * inserts element, marking it dirty.
+   */
+  std::pair<iterator, bool> insert(const value_type& value) {
+    std::pair<iterator, bool> result = m.insert(value);
+    mark(value.first);
+    return result;
+  }
+  void reserve(const K& low, const K& high) {
+    m.reserve(low, high);
+  }
+  /**
+   * sets lower limit of keys, removing lower elements.
+   * if elements are removed, the next checkpoint writes a base record
+   * as clear() does, so that regrown keys do not recover old values.
+   */
+  CheckpointedMap& setLowerLimit(const K& key) {
+    const size_t before = m.size();
+    m.setLowerLimit(key);
+    trimmed(before);
+    return *this;
+  }
+  /**
+   * sets higher limit of keys, removing higher elements.
+   * same as setLowerLimit() for removed elements.
+   */
+  CheckpointedMap& setHigherLimit(const K& key) {
+    const size_t before = m.size();
+    m.setHigherLimit(key);
+    trimmed(before);
+    return *this;
+  }
+  /**
+   * removes all elements.
+   * the next checkpoint writes all elements as a base record,
+   * since elements regrown afterwards are not all marked dirty.
+   */
+  void clear() {
+    m.clear();
+    dirty.clear();
+    cleared = true;
+  }
+  /**
+   * takes a consistent cut of dirty pages and the region of elements,
+   * and queues it to be appended to the log.
+   * must be called from the thread modifying the container.
+   *
+   * exceptions:
+   *   std::system_error if previous write failed.
+   */
+  void checkpoint() {
+    rethrow();
+    if (compactInterval > 0 && ++checkpoints >= compactInterval) {
+      compact();
+      return;
+    }
+    if (cleared) {
+      enqueue(base(), false);
+      return;
+    }
+    std::vector<char> record;
+    checkpoint::header(&record, checkpoint::kDelta, m, 0);
+    // the number of pages is patched after they are appended.
+    const size_t pagesAt = record.size() - sizeof(uint64_t);
+    uint64_t pages = 0;
+    for (size_t w = 0; w < dirty.size(); ++w) {
+      for (uint64_t bits = dirty[w]; bits != 0; bits &= bits - 1) {
+        const int64_t p = firstPage +
+          static_cast<int64_t>(w * 64 + __builtin_ctzll(bits));
+        pages += appendPage(&record, p);
+      }
+    }
+    std::memcpy(&record[pagesAt], &pages, sizeof(pages));
+    dirty.clear();
+    enqueue(std::move(record), false);
+  }
+  /**
+   * takes a snapshot of all elements,
+   * and queues it to replace the log.
+   * must be called from the thread modifying the container.
+   *
+   * exceptions:
+   *   std::system_error if previous write failed.
+   */
+  void compact() {
+    rethrow();
+    checkpoints = 0;
+    enqueue(base(), true);
+  }
+  /**
+   * waits until queued checkpoints are written.
+   *
+   * exceptions:
+   *   std::system_error if write failed.
+   */
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return jobs.empty() && !writing; });
+    lock.unlock();
+    rethrow();
+  }
+
+ private:
+  struct Job {
+    std::vector<char> record;
+    bool compact;
+  };
+  map_type m;
+  const std::string path;
+  const size_t compactInterval;
+  size_t checkpoints;
+  /**
+   * page p holds keys [anchor + p * PageSlots, anchor + (p + 1) * PageSlots).
+   */
+  K anchor;
+  bool hasAnchor;
+  /**
+   * dirty bit of page (firstPage + i) is dirty[i / 64] bit (i % 64).
+   */
+  std::vector<uint64_t> dirty;
+  int64_t firstPage;
+  /**
+   * whether clear() was called after the last checkpoint.
+   */
+  bool cleared;
+  int fd;
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::condition_variable done;
+  std::deque<Job> jobs;
+  bool stopping;
+  bool writing;
+  std::exception_ptr error;
+
+  /**
+   * returns a base record of all elements, clearing dirty pages.
+   */
+  std::vector<char> base() {
+    std::vector<char> record;
+    checkpoint::header(&record, checkpoint::kBase, m, m.empty() ? 0 : 1);
+    if (!m.empty()) {
+      checkpoint::page(&record, m, m.begin()->first,
+                       static_cast<uint64_t>(m.size()));
+    }
+    dirty.clear();
+    cleared = false;
+    return record;
+  }
+  /**
+   * requests a base record if elements were removed from before.
+   */
+  void trimmed(size_t before) {
+    if (m.size() < before) {
+      dirty.clear();
+      cleared = true;
+    }
+  }
+  int64_t pageOf(const K& key) const {
+    const int64_t d = static_cast<int64_t>(key) -
+      static_cast<int64_t>(anchor);
+    const int64_t slots = static_cast<int64_t>(PageSlots);
+    return d >= 0 ? d / slots : -((-d + slots - 1) / slots);
+  }
+  void mark(const K& key) {
+    if (!hasAnchor) {
+      anchor = key;
+      hasAnchor = true;
+    }
+    const int64_t p = pageOf(key);
+    if (dirty.empty()) {
+      firstPage = p & ~int64_t(63);
+    } else if (p < firstPage) {
+      const int64_t first = p & ~int64_t(63);
+      dirty.insert(dirty.begin(), (firstPage - first) / 64, 0);
+      firstPage = first;
+    }
+    const size_t i = static_cast<size_t>(p - firstPage);
+    if (i / 64 >= dirty.size()) {
+      dirty.resize(i / 64 + 1, 0);
+    }
+    dirty[i / 64] |= uint64_t(1) << (i % 64);
+  }
+  /**
+   * appends page p if it has elements. returns the number of pages.
+   */
+  uint64_t appendPage(std::vector<char>* record, int64_t p) const {
+    if (m.empty()) {
+      return 0;
+    }
+    const int64_t slots = static_cast<int64_t>(PageSlots);
+    const int64_t low = std::max<int64_t>(
+      static_cast<int64_t>(anchor) + p * slots,
+      static_cast<int64_t>(m.begin()->first));
+    const int64_t high = std::min<int64_t>(
+      static_cast<int64_t>(anchor) + (p + 1) * slots - 1,
+      static_cast<int64_t>(m.rbegin()->first));
+    if (low > high) {
+      return 0;
+    }
+    checkpoint::page(record, m, static_cast<K>(low),
+                     static_cast<uint64_t>(high - low + 1));
+    return 1;
+  }
+  void enqueue(std::vector<char>&& record, bool compact) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(Job{std::move(record), compact});
+    }
+    wakeup.notify_one();
+  }
+  void rethrow() {
+    std::exception_ptr e;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::swap(e, error);
+    }
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+  /**
+   * background writer.
+   */
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty()) {
+        return;
+      }
+      Job job = std::move(jobs.front());
+      jobs.pop_front();
+      writing = true;
+      lock.unlock();
+      try {
+        if (job.compact) {
+          replace(job.record);
+        } else {
+          checkpoint::writeAll(fd, job.record);
+          if (::fdatasync(fd) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "fdatasync");
+          }
+        }
+      } catch (...) {
+        lock.lock();
+        error = std::current_exception();
+        lock.unlock();
+      }
+      lock.lock();
+      writing = false;
+      done.notify_all();
+    }
+  }
+  /**
+   * replaces the log with given base record.
+   */
+  void replace(const std::vector<char>& record) {
+    const std::string tmp = path + ".tmp";
+    const int tmpFd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmpFd < 0) {
+      throw std::system_error(errno, std::generic_category(), tmp);
+    }
+    try {
+      checkpoint::writeAll(tmpFd, record);
+    } catch (...) {
+      ::close(tmpFd);
+      throw;
+    }
+    if (::fsync(tmpFd) != 0) {
+      const int e = errno;
+      ::close(tmpFd);
+      throw std::system_error(e, std::generic_category(), tmp);
+    }
+    ::close(tmpFd);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    const int newFd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    if (newFd < 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    ::close(fd);
+    fd = newFd;
+  }
+};
+#endif  // CHECKPOINT_H_
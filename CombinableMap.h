@@ -0,0 +1,185 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef COMBINABLEMAP_H_
+#define COMBINABLEMAP_H_
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "MimicMap.h"
+
+/**
+ * thread-local MimicMaps to be reduced into one.
+ *
+ * each thread accumulates into its own map returned by local()
+ * without any synchronization, then reduce() merges all maps.
+ */
+template<typename K, typename V>
+class CombinableMap {
+ public:
+  using map_type = MimicMap<K, V>;
+  using value_type = typename map_type::value_type;
+  /**
+   * constructs without thread-local maps.
+   */
+  CombinableMap() : serial(nextSerial()) {}
+  CombinableMap(const CombinableMap&) = delete;
+  CombinableMap& operator=(const CombinableMap&) = delete;
+  /**
+   * returns the map of the calling thread, creating it if not exists.
+   * the map is cached per thread and instance,
+   * so that repeated calls take no lock.
+   */
+  map_type& local() {
+    Cache& cache = threadCache()[serial % kCacheSlots];
+    if (cache.serial == serial) {
+      return *cache.map;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<map_type>& map = locals[std::this_thread::get_id()];
+    if (!map) {
+      map.reset(new map_type());
+    }
+    cache.serial = serial;
+    cache.map = map.get();
+    return *map;
+  }
+  /**
+   * calls f(map) for each thread-local map.
+   * must not run concurrently with local().
+   */
+  template <typename F>
+  void combineEach(F f) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry : locals) {
+      f(static_cast<const map_type&>(*entry.second));
+    }
+  }
+  /**
+   * removes all thread-local maps.
+   * must not run concurrently with local().
+   */
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    locals.clear();
+    serial = nextSerial();
+  }
+  /**
+   * returns all thread-local maps merged into one.
+   *
+   * the result is allocated once to cover keys of all maps,
+   * and its key range is divided into chunks merged by worker threads.
+   * elements of keys in several maps are combined by op,
+   * which must be associative and commutative.
+   * threads 0 means one for each CPU.
+   * must not run concurrently with local().
+   */
+  template <typename BinaryOp>
+  map_type reduce(BinaryOp op, unsigned threads = 0) const {
+    std::vector<const map_type*> maps;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const auto& entry : locals) {
+        if (!entry.second->empty()) {
+          maps.push_back(entry.second.get());
+        }
+      }
+    }
+    map_type result;
+    if (maps.empty()) {
+      return result;
+    }
+    K low = maps[0]->begin()->first;
+    K high = maps[0]->rbegin()->first;
+    for (const map_type* map : maps) {
+      low = std::min(low, map->begin()->first);
+      high = std::max(high, map->rbegin()->first);
+    }
+    result.reserve(low, high);
+    const size_t n = result.size();
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(
+      std::min<size_t>(threads, (n + kMinChunk - 1) / kMinChunk));
+    value_type* const base = &*result.begin();
+    if (threads <= 1) {
+      mergeChunk(maps, base, low, 0, n, op);
+      return result;
+    }
+    const size_t chunk = (n + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+      const size_t first = t * chunk;
+      const size_t last = std::min(n, first + chunk);
+      workers.emplace_back([&, first, last]() {
+          mergeChunk(maps, base, low, first, last, op);
+        });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    return result;
+  }
+
+ private:
+  /**
+   * chunks smaller than this are not worth a thread.
+   */
+  static constexpr size_t kMinChunk = 64 * 1024;
+  /**
+   * slots of the thread-local cache indexed by serial,
+   * so that maps created one after another do not evict each other.
+   */
+  static constexpr size_t kCacheSlots = 16;
+  struct Cache {
+    uint64_t serial;
+    map_type* map;
+  };
+  uint64_t serial;
+  mutable std::mutex mutex;
+  std::unordered_map<std::thread::id, std::unique_ptr<map_type> > locals;
+
+  static uint64_t nextSerial() {
+    static std::atomic<uint64_t> counter(0);
+    return ++counter;
+  }
+  static Cache* threadCache() {
+    static thread_local Cache cache[kCacheSlots] = {};
+    return cache;
+  }
+  /**
+   * merges elements of offsets [first, last) from low.
+   */
+  template <typename BinaryOp>
+  static void mergeChunk(const std::vector<const map_type*>& maps,
+                         value_type* base, const K& low,
+                         size_t first, size_t last, BinaryOp op) {
+    // bytes rather than bits, so that setting one reads no neighbors.
+    std::vector<uint8_t> seen(last - first, 0);
+    for (const map_type* map : maps) {
+      const size_t mapFirst = static_cast<size_t>(map->begin()->first - low);
+      const size_t from = std::max(first, mapFirst);
+      const size_t to = std::min(last, mapFirst + map->size());
+      if (from >= to) {
+        continue;
+      }
+      const value_type* src = &*map->begin() + (from - mapFirst);
+      value_type* dst = base + from;
+      for (size_t i = 0; i < to - from; ++i) {
+        if (seen[from - first + i]) {
+          dst[i].second = op(dst[i].second, src[i].second);
+        } else {
+          dst[i].second = src[i].second;
+          seen[from - first + i] = 1;
+        }
+      }
+    }
+  }
+};
+#endif  // COMBINABLEMAP_H_
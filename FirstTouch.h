@@ -0,0 +1,269 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef FIRSTTOUCH_H_
+#define FIRSTTOUCH_H_
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+/**
+ * how reserve() places pages of elements on NUMA nodes.
+ *
+ * pages are touched first by worker threads pinned to CPUs of the node
+ * so that the kernel allocates them on the node (first-touch policy).
+ */
+struct FirstTouchPolicy {
+  enum Placement {
+    /**
+     * splits elements into contiguous parts, one for each node.
+     * suits threads scanning their own part of keys.
+     */
+    kPartition,
+    /**
+     * distributes chunks of chunkBytes over nodes round-robin.
+     * suits threads accessing keys at random.
+     */
+    kInterleave,
+  };
+  Placement placement;
+  /**
+   * the number of worker threads. 0 means one for each CPU.
+   */
+  unsigned threads;
+  /**
+   * NUMA nodes to place pages on. empty means all nodes.
+   */
+  std::vector<int> nodes;
+  /**
+   * interleave granularity.
+   */
+  size_t chunkBytes;
+  /**
+   * regions smaller than this are touched by the calling thread.
+   */
+  size_t minParallelBytes;
+  explicit FirstTouchPolicy(Placement where = kPartition,
+                            unsigned workers = 0)
+    : placement(where), threads(workers),
+      chunkBytes(2 * 1024 * 1024), minParallelBytes(4 * 1024 * 1024) {}
+};
+
+namespace first_touch {
+/**
+ * parses cpulist format such as "0-3,8-11".
+ */
+inline std::vector<int> parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last = dash == std::string::npos ?
+        first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception&) {
+      // ignores malformed entry.
+    }
+  }
+  return cpus;
+}
+/**
+ * returns CPUs of given NUMA node. empty if unknown.
+ */
+inline std::vector<int> nodeCpus(int node) {
+  std::ifstream in("/sys/devices/system/node/node" +
+                   std::to_string(node) + "/cpulist");
+  std::string list;
+  if (!std::getline(in, list)) {
+    return std::vector<int>();
+  }
+  return parseCpuList(list);
+}
+/**
+ * returns online NUMA nodes. {0} if unknown.
+ */
+inline std::vector<int> onlineNodes() {
+  std::ifstream in("/sys/devices/system/node/online");
+  std::string list;
+  std::vector<int> nodes;
+  if (std::getline(in, list)) {
+    nodes = parseCpuList(list);
+  }
+  if (nodes.empty()) {
+    nodes.push_back(0);
+  }
+  return nodes;
+}
+inline size_t pageSize() {
+#ifdef __linux__
+  const long size = sysconf(_SC_PAGESIZE);  // NOLINT
+  if (size > 0) {
+    return static_cast<size_t>(size);
+  }
+#endif
+  return 4096;
+}
+/**
+ * pins the calling thread to given CPUs.
+ */
+inline void pin(const std::vector<int>& cpus) {
+#ifdef __linux__
+  if (cpus.empty()) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpus;
+#endif
+}
+/**
+ * writes one byte in each page of [first, last).
+ */
+inline void touch(char* first, char* last, size_t page) {
+  for (char* p = first; p < last; p += page) {
+    *static_cast<volatile char*>(p) = 0;
+  }
+}
+/**
+ * true if Storage has append(n, construct), which lets construct
+ * build n elements in place on not yet constructed capacity.
+ */
+template<typename Storage, typename = void>
+struct HasAppend : std::false_type {};
+template<typename Storage>
+struct HasAppend<Storage, std::void_t<decltype(
+    std::declval<Storage&>().append(
+        size_t(0),
+        std::declval<void (*)(typename Storage::value_type*)>()))>>
+  : std::true_type {};
+}  // namespace first_touch
+
+/**
+ * splits [storage, storage + bytes) at page boundaries according to policy,
+ * and calls visit(first, last) with byte offsets of each part
+ * on worker threads pinned to CPUs of the node of the part.
+ * if inOrder, one thread for each node visits its parts
+ * taking turns with others, so that parts are visited in order.
+ * the whole range is visited by the calling thread if small.
+ * the first exception thrown by visit is rethrown after all threads end.
+ */
+template<typename F>
+void firstTouch(void* storage, size_t bytes,
+                const FirstTouchPolicy& policy, F visit,
+                bool inOrder = false) {
+  const size_t page = first_touch::pageSize();
+  if (bytes < policy.minParallelBytes) {
+    visit(size_t(0), bytes);
+    return;
+  }
+  const std::vector<int> nodes =
+    policy.nodes.empty() ? first_touch::onlineNodes() : policy.nodes;
+  unsigned threads = policy.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<unsigned>(threads, static_cast<unsigned>(nodes.size()));
+  if (inOrder) {
+    threads = static_cast<unsigned>(nodes.size());
+  }
+  // offsets are measured from the page boundary below storage,
+  // so that units of work split the range at page boundaries.
+  const size_t head = reinterpret_cast<uintptr_t>(storage) % page;
+  const size_t span = head + bytes;
+  const size_t chunk = policy.placement == FirstTouchPolicy::kInterleave ?
+    std::max(page, policy.chunkBytes / page * page) :
+    (span / nodes.size() + page - 1) / page * page;
+  const size_t chunks = (span + chunk - 1) / chunk;
+  std::mutex mutex;
+  std::condition_variable turn;
+  // the chunk to visit next if inOrder.
+  size_t next = 0;
+  std::exception_ptr error;
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    const size_t n = t % nodes.size();
+    // threads working for the node, and the index among them.
+    const size_t peers = threads / nodes.size() +
+      (n < threads % nodes.size() ? 1 : 0);
+    const size_t peer = t / nodes.size();
+    workers.emplace_back([&, n, peers, peer]() {
+        first_touch::pin(first_touch::nodeCpus(nodes[n]));
+        for (size_t c = n; c < chunks; c += nodes.size()) {
+          const size_t first = c * chunk;
+          const size_t last = std::min(span, first + chunk);
+          const size_t pages = (last - first + page - 1) / page;
+          const size_t mine = first + pages * peer / peers * page;
+          const size_t end = first + pages * (peer + 1) / peers * page;
+          const size_t from = std::max(mine, head);
+          const size_t to = std::min(end, last);
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (inOrder) {
+              turn.wait(lock, [&]() { return next == c || error; });
+            }
+            if (error) {
+              return;
+            }
+          }
+          try {
+            if (from < to) {
+              visit(from - head, to - head);
+            }
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+          }
+          if (inOrder) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++next;
+            turn.notify_all();
+          }
+        }
+      });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+/**
+ * touches pages of not yet constructed storage
+ * in parallel according to policy.
+ */
+inline void firstTouch(void* storage, size_t bytes,
+                       const FirstTouchPolicy& policy) {
+  char* const base = static_cast<char*>(storage);
+  const size_t page = first_touch::pageSize();
+  firstTouch(storage, bytes, policy, [=](size_t first, size_t last) {
+      first_touch::touch(base + first, base + last, page);
+    });
+}
+#endif  // FIRSTTOUCH_H_
@@ -0,0 +1,237 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef FIXEDVECTOR_H_
+#define FIXEDVECTOR_H_
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace fixed_vector {
+/**
+ * assigns by members for std::pair,
+ * whose assignment is not constexpr before C++20.
+ */
+template<typename T>
+constexpr void assign(T* dst, T&& src) {
+  *dst = std::move(src);
+}
+template<typename A, typename B>
+constexpr void assign(std::pair<A, B>* dst, std::pair<A, B>&& src) {
+  dst->first = std::move(src.first);
+  dst->second = std::move(src.second);
+}
+}  // namespace fixed_vector
+
+/**
+ * std::vector like sequence container
+ * storing up to N elements inside the object.
+ *
+ * all operations are constexpr,
+ * so that containers can be built in constant expressions.
+ * growing beyond N throws std::length_error.
+ */
+template<typename T, size_t N>
+class FixedVector {
+ public:
+  /**
+   * allocates nothing. exists for containers passing allocators.
+   */
+  struct allocator_type {
+    using value_type = T;
+    constexpr bool operator==(const allocator_type&) const {
+      return true;
+    }
+    constexpr bool operator!=(const allocator_type&) const {
+      return false;
+    }
+  };
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  /**
+   * constructs an empty container.
+   */
+  constexpr explicit FixedVector(
+    const allocator_type& = allocator_type())
+    : items(), count(0) {}
+  /**
+   * constructs with the contents of the range [first, last).
+   */
+  template<typename IT>
+  constexpr FixedVector(IT first, IT last,
+                        const allocator_type& = allocator_type())
+    : items(), count(0) {
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+  }
+  /**
+   * copy constructor with allocator.
+   */
+  constexpr FixedVector(const FixedVector& orig, const allocator_type&)
+    : FixedVector(orig) {}
+  FixedVector(const FixedVector&) = default;
+  FixedVector(FixedVector&&) = default;
+  /**
+   * copy assign operator.
+   */
+  constexpr FixedVector& operator=(const FixedVector& orig) {
+    for (size_t i = 0; i < std::max(count, orig.count); ++i) {
+      fixed_vector::assign(&items[i], T(orig.items[i]));
+    }
+    count = orig.count;
+    return *this;
+  }
+  /**
+   * move assign operator.
+   */
+  constexpr FixedVector& operator=(FixedVector&& orig) {
+    for (size_t i = 0; i < std::max(count, orig.count); ++i) {
+      fixed_vector::assign(&items[i], std::move(orig.items[i]));
+    }
+    count = orig.count;
+    return *this;
+  }
+  constexpr allocator_type get_allocator() const {
+    return allocator_type();
+  }
+  constexpr size_t size() const {
+    return count;
+  }
+  constexpr size_t capacity() const {
+    return N;
+  }
+  constexpr size_t max_size() const {
+    return N;
+  }
+  constexpr bool empty() const {
+    return count == 0;
+  }
+  constexpr T* data() {
+    return items.data();
+  }
+  constexpr const T* data() const {
+    return items.data();
+  }
+  constexpr T& operator[](size_t i) {
+    return items[i];
+  }
+  constexpr const T& operator[](size_t i) const {
+    return items[i];
+  }
+  constexpr iterator begin() {
+    return items.data();
+  }
+  constexpr const_iterator begin() const {
+    return items.data();
+  }
+  constexpr const_iterator cbegin() const {
+    return items.data();
+  }
+  constexpr iterator end() {
+    return items.data() + count;
+  }
+  constexpr const_iterator end() const {
+    return items.data() + count;
+  }
+  constexpr const_iterator cend() const {
+    return items.data() + count;
+  }
+  constexpr reverse_iterator rbegin() {
+    return reverse_iterator(end());
+  }
+  constexpr const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  constexpr const_reverse_iterator crbegin() const {
+    return const_reverse_iterator(end());
+  }
+  constexpr reverse_iterator rend() {
+    return reverse_iterator(begin());
+  }
+  constexpr const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+  constexpr const_reverse_iterator crend() const {
+    return const_reverse_iterator(begin());
+  }
+  /**
+   * checks that n elements fit.
+   *
+   * exceptions:
+   *   std::length_error if n exceeds N.
+   */
+  constexpr void reserve(size_t n) {
+    if (n > N) {
+      throw std::length_error("FixedVector capacity exceeded");
+    }
+  }
+  /**
+   * exceptions:
+   *   std::length_error if already full.
+   */
+  template<typename... Args>
+  constexpr T& emplace_back(Args&&... args) {
+    reserve(count + 1);
+    fixed_vector::assign(&items[count], T(std::forward<Args>(args)...));
+    return items[count++];
+  }
+  constexpr void push_back(const T& value) {
+    emplace_back(value);
+  }
+  /**
+   * removes elements in [from, to).
+   */
+  constexpr iterator erase(const_iterator from, const_iterator to) {
+    const size_t first = static_cast<size_t>(from - cbegin());
+    const size_t n = static_cast<size_t>(to - from);
+    for (size_t i = first; i + n < count; ++i) {
+      fixed_vector::assign(&items[i], std::move(items[i + n]));
+    }
+    for (size_t i = count - n; i < count; ++i) {
+      fixed_vector::assign(&items[i], T());
+    }
+    count -= n;
+    return begin() + first;
+  }
+  /**
+   * changes the number of elements.
+   */
+  constexpr void resize(size_t n) {
+    reserve(n);
+    for (size_t i = n; i < count; ++i) {
+      fixed_vector::assign(&items[i], T());
+    }
+    count = n;
+  }
+  /**
+   * removes all elements.
+   */
+  constexpr void clear() {
+    resize(0);
+  }
+  constexpr void swap(FixedVector& other) {
+    FixedVector tmp = std::move(other);
+    other = std::move(*this);
+    *this = std::move(tmp);
+  }
+
+ private:
+  /**
+   * elements beyond count are kept default constructed.
+   */
+  std::array<T, N> items;
+  size_t count;
+};
+#endif  // FIXEDVECTOR_H_
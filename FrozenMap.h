@@ -0,0 +1,384 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef FROZENMAP_H_
+#define FROZENMAP_H_
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "MimicMap.h"
+
+/**
+ * the immutable, compressed form of MimicMap.
+ *
+ * values are divided into blocks of 64 keys.
+ * each block is stored as one of:
+ *   - a single value (gap or repeated blocks),
+ *   - run-length encoded values,
+ *   - base value and narrow offsets (integral values only),
+ *   - raw values,
+ * whichever is the smallest.
+ * if headers of blocks make the whole larger than raw values,
+ * as for 1 byte values which do not compress,
+ * values are stored raw without blocks.
+ * any element is decoded in constant time.
+ */
+template<typename K, typename V>
+class FrozenMap {
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  /**
+   * iterator yielding decoded elements.
+   */
+  class const_iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = FrozenMap::value_type;
+    using reference = value_type;
+    using pointer = void;
+    const_iterator() : map(nullptr), offset(0) {}
+    reference operator*() const {
+      return value_type(static_cast<K>(map->minKey + offset),
+                        map->decode(offset));
+    }
+    const_iterator& operator++() {
+      ++offset;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator tmp(*this);
+      ++offset;
+      return tmp;
+    }
+    bool operator==(const const_iterator& other) const {
+      return offset == other.offset;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return offset != other.offset;
+    }
+
+   private:
+    friend class FrozenMap;
+    const_iterator(const FrozenMap* m, size_t i) : map(m), offset(i) {}
+    const FrozenMap* map;
+    size_t offset;
+  };
+  using iterator = const_iterator;
+  /**
+   * constructs an empty container.
+   */
+  FrozenMap() : minKey(), count_(0) {}
+  /**
+   * constructs with the contents of the range [first, last).
+   * keys of the range must be consecutive and sorted,
+   * as those of MimicMap and RigidMap.
+   */
+  template<typename IT>
+  FrozenMap(IT first, IT last) : minKey(), count_(0) {
+    std::vector<V> block;
+    block.reserve(kBlock);
+    for (IT iter = first; iter != last; ++iter) {
+      if (count_ == 0) {
+        minKey = iter->first;
+      }
+      block.push_back(iter->second);
+      ++count_;
+      if (block.size() == kBlock) {
+        encode(block);
+        block.clear();
+      }
+    }
+    if (!block.empty()) {
+      encode(block);
+    }
+    if (compressedSize() > count_ * sizeof(V)) {
+      std::vector<V> raw;
+      raw.reserve(count_);
+      for (size_t offset = 0; offset < count_; ++offset) {
+        raw.push_back(decode(offset));
+      }
+      blocks.clear();
+      bytes.clear();
+      values.swap(raw);
+    }
+    values.shrink_to_fit();
+    bytes.shrink_to_fit();
+  }
+  /**
+   * returns the number of elements.
+   * same as the number from minimum key to maximum key.
+   */
+  size_t size() const {
+    return count_;
+  }
+  /**
+   * returns the number of bytes occupied by encoded elements.
+   */
+  size_t compressedSize() const {
+    return blocks.size() * sizeof(Block) +
+      values.size() * sizeof(V) + bytes.size();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  const_iterator begin() const {
+    return cbegin();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  const_iterator cbegin() const {
+    return const_iterator(this, 0);
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  const_iterator end() const {
+    return cend();
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  const_iterator cend() const {
+    return const_iterator(this, count_);
+  }
+  /**
+   * checks whether the container is empty.
+   */
+  bool empty() const {
+    return count_ == 0;
+  }
+  /**
+   * returns the number of elements matching specific key.
+   */
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  /**
+   * checks if the container contains element with specific key.
+   */
+  template <typename Key>
+  bool contains(const Key& key) const {
+    if (empty()) {
+      return false;
+    }
+    return !(key < minKey) &&
+      static_cast<size_t>(key - minKey) < count_;
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  const_iterator find(const Key& key) const {
+    if (!contains(key)) {
+      return end();
+    }
+    return const_iterator(this, static_cast<size_t>(key - minKey));
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  V at(const Key& key) const {
+    if (!contains(key)) {
+      throw std::out_of_range("key not found");
+    }
+    return decode(static_cast<size_t>(key - minKey));
+  }
+  /**
+   * returns the mutable form.
+   */
+  MimicMap<K, V> thaw() const {
+    MimicMap<K, V> m;
+    if (empty()) {
+      return m;
+    }
+    m.reserve(minKey, static_cast<K>(minKey + (count_ - 1)));
+    size_t offset = 0;
+    for (typename MimicMap<K, V>::iterator
+           iter = m.begin(); iter != m.end(); ++iter) {
+      iter->second = decode(offset++);
+    }
+    return m;
+  }
+
+ private:
+  static constexpr size_t kBlock = 64;
+  static constexpr bool kDeltaEncodable =
+    std::is_integral<V>::value && !std::is_same<V, bool>::value;
+  enum Kind : uint8_t {
+    kConstant,  // values[value]
+    kRuns,      // values[value + n], n-th run. aux: bitmap of run starts.
+    kDelta,     // values[value] + offset. aux: offsets in bytes.
+    kRaw,       // values[value + i]
+  };
+  struct Block {
+    Kind kind;
+    uint8_t width;
+    size_t value;
+    uint64_t aux;
+  };
+  K minKey;
+  size_t count_;
+  std::vector<Block> blocks;
+  std::vector<V> values;
+  std::vector<uint8_t> bytes;
+
+  V decode(size_t offset) const {
+    if (blocks.empty()) {
+      return values[offset];
+    }
+    const Block& b = blocks[offset / kBlock];
+    const size_t i = offset % kBlock;
+    switch (b.kind) {
+    case kConstant:
+      return values[b.value];
+    case kRuns:
+      return values[b.value + runIndex(b.aux, i)];
+    case kDelta:
+      return delta(b, i);
+    default:
+      return values[b.value + i];
+    }
+  }
+  static size_t runIndex(uint64_t starts, size_t i) {
+    const uint64_t mask = (i == 63) ? ~uint64_t(0) : ((uint64_t(2) << i) - 1);
+    return static_cast<size_t>(__builtin_popcountll(starts & mask)) - 1;
+  }
+  V delta(const Block& b, size_t i) const {
+    if constexpr (kDeltaEncodable) {
+      const uint8_t* p = &bytes[b.aux + i * b.width];
+      uint64_t d = 0;
+      // offsets are stored from the lowest byte in any byte order.
+      for (uint8_t k = 0; k < b.width; ++k) {
+        d |= static_cast<uint64_t>(p[k]) << (8 * k);
+      }
+      return static_cast<V>(static_cast<uint64_t>(values[b.value]) + d);
+    } else {
+      (void)b;
+      (void)i;
+      return V();
+    }
+  }
+  /**
+   * appends one block choosing the smallest encoding.
+   */
+  void encode(const std::vector<V>& block) {
+    const size_t n = block.size();
+    uint64_t starts = 1;
+    size_t runs = 1;
+    for (size_t i = 1; i < n; ++i) {
+      if (!(block[i] == block[i - 1])) {
+        starts |= uint64_t(1) << i;
+        ++runs;
+      }
+    }
+    Block b = {kRaw, 0, values.size(), 0};
+    size_t cost = n * sizeof(V);
+    uint8_t width = 0;
+    V base = block[0];
+    if constexpr (kDeltaEncodable) {
+      V high = block[0];
+      for (size_t i = 1; i < n; ++i) {
+        if (block[i] < base) {
+          base = block[i];
+        }
+        if (high < block[i]) {
+          high = block[i];
+        }
+      }
+      const uint64_t range =
+        static_cast<uint64_t>(high) - static_cast<uint64_t>(base);
+      width = range <= 0xFF ? 1 : range <= 0xFFFF ? 2 :
+        range <= 0xFFFFFFFF ? 4 : 0;
+      if (width != 0 && width < sizeof(V) &&
+          sizeof(V) + n * width < cost) {
+        b.kind = kDelta;
+        cost = sizeof(V) + n * width;
+      }
+    }
+    if (runs * sizeof(V) <= cost) {
+      b.kind = runs == 1 ? kConstant : kRuns;
+    }
+    switch (b.kind) {
+    case kConstant:
+      values.push_back(block[0]);
+      break;
+    case kRuns:
+      b.aux = starts;
+      for (size_t i = 0; i < n; ++i) {
+        if (starts & (uint64_t(1) << i)) {
+          values.push_back(block[i]);
+        }
+      }
+      break;
+    case kDelta:
+      if constexpr (kDeltaEncodable) {
+        b.width = width;
+        b.aux = bytes.size();
+        values.push_back(base);
+        for (size_t i = 0; i < n; ++i) {
+          const uint64_t d =
+            static_cast<uint64_t>(block[i]) - static_cast<uint64_t>(base);
+          for (uint8_t k = 0; k < width; ++k) {
+            bytes.push_back(static_cast<uint8_t>(d >> (8 * k)));
+          }
+        }
+      }
+      break;
+    default:
+      values.insert(values.end(), block.begin(), block.end());
+      break;
+    }
+    blocks.push_back(b);
+  }
+};
+/**
+ * returns the immutable, compressed form of MimicMap or RigidMap.
+ */
+template<typename M>
+FrozenMap<typename M::value_type::first_type,
+          typename M::value_type::second_type> freeze(const M& m) {
+  return FrozenMap<typename M::value_type::first_type,
+                   typename M::value_type::second_type>(m.begin(), m.end());
+}
+/**
+ * builds FixedMap of given elements in a constant expression,
+ * so that the table is placed in read-only data:
+ *
+ *   constexpr auto table = makeFrozenMap<int, int, 3>({{1, 10}, {3, 30}});
+ *
+ * Span is the number of keys from the lowest to the highest;
+ * 0 means the number of elements, which suits consecutive keys.
+ * a later element of the same key overwrites earlier one.
+ *
+ * exceptions:
+ *   std::length_error if keys span more than Span,
+ *   which fails compilation in a constant expression.
+ */
+template<typename K, typename V, size_t Span = 0, size_t N>
+constexpr FixedMap<K, V, (Span == 0 ? N : Span)> makeFrozenMap(
+  const std::pair<K, V> (&elements)[N]) {
+  FixedMap<K, V, (Span == 0 ? N : Span)> m;
+  K low = elements[0].first;
+  K high = elements[0].first;
+  for (const std::pair<K, V>& e : elements) {
+    low = e.first < low ? e.first : low;
+    high = high < e.first ? e.first : high;
+  }
+  m.reserve(low, high);
+  for (const std::pair<K, V>& e : elements) {
+    m[e.first] = e.second;
+  }
+  return m;
+}
+#endif  // FROZENMAP_H_
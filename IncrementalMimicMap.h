@@ -0,0 +1,589 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef INCREMENTALMIMICMAP_H_
+#define INCREMENTALMIMICMAP_H_
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * MimicMap growing without long stalls.
+ *
+ * storage for the region of elements is allocated at once,
+ * but elements are constructed only when written.
+ * when the region exceeds the storage, larger storage is allocated,
+ * and elements written so far are moved from old storage
+ * Step slots at a time by each write operation,
+ * so that the cost of a write does not depend on how far the key is.
+ * until then, reads look into old storage for elements not moved yet.
+ *
+ * a growth while moving elements adds another old storage.
+ * since storage at least doubles, there are at most
+ * as many old storages as bits of K.
+ */
+template<typename K, typename V, size_t Step = 1024>
+class IncrementalMimicMap {
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(Step > 0, "Step must be positive");
+  using U = typename std::make_unsigned<K>::type;
+
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using iterator = value_type*;
+  /**
+   * iterator yielding elements read as at() does,
+   * without moving or constructing elements.
+   */
+  class const_iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = IncrementalMimicMap::value_type;
+    using reference = value_type;
+    using pointer = void;
+    const_iterator() : map(nullptr), offset(0) {}
+    reference operator*() const {
+      const K key = static_cast<K>(static_cast<U>(U(map->minKey) + offset));
+      return value_type(key, map->value(key));
+    }
+    const_iterator& operator++() {
+      ++offset;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator tmp(*this);
+      ++offset;
+      return tmp;
+    }
+    bool operator==(const const_iterator& other) const {
+      return offset == other.offset;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return offset != other.offset;
+    }
+
+   private:
+    friend class IncrementalMimicMap;
+    const_iterator(const IncrementalMimicMap* m, size_t i)
+      : map(m), offset(i) {}
+    const IncrementalMimicMap* map;
+    size_t offset;
+  };
+  /**
+   * constructs an empty container.
+   */
+  IncrementalMimicMap() : minKey(), maxKey(), hasElements(false),
+                          dense(true) {}
+  IncrementalMimicMap(const IncrementalMimicMap&) = delete;
+  IncrementalMimicMap& operator=(const IncrementalMimicMap&) = delete;
+  /**
+   * move constructor.
+   */
+  IncrementalMimicMap(IncrementalMimicMap&& orig) noexcept
+    : IncrementalMimicMap() {
+    swap(orig);
+  }
+  /**
+   * move assign operator.
+   */
+  IncrementalMimicMap& operator=(IncrementalMimicMap&& orig) noexcept {
+    IncrementalMimicMap(std::move(orig)).swap(*this);
+    return *this;
+  }
+  ~IncrementalMimicMap() {
+    clear();
+  }
+  void swap(IncrementalMimicMap& other) noexcept {
+    std::swap(cur, other.cur);
+    std::swap(olds, other.olds);
+    std::swap(minKey, other.minKey);
+    std::swap(maxKey, other.maxKey);
+    std::swap(hasElements, other.hasElements);
+    std::swap(dense, other.dense);
+    std::swap(onGrow, other.onGrow);
+  }
+  /**
+   * sets a function called when moving elements to new storage starts.
+   * it may let a background thread call migrate(),
+   * synchronized with other operations by the caller.
+   */
+  void setOnGrow(std::function<void()> f) {
+    onGrow = std::move(f);
+  }
+  /**
+   * checks whether elements are being moved to new storage.
+   */
+  bool migrating() const {
+    return !olds.empty();
+  }
+  /**
+   * moves elements of about n slots to new storage.
+   * returns true if elements remain in old storage.
+   */
+  bool migrate(size_t n = std::numeric_limits<size_t>::max()) {
+    size_t budget = n;
+    while (!olds.empty() && budget > 0) {
+      Slots& old = olds.front();
+      const size_t words = wordsOf(old.capacity);
+      const size_t first = old.cursor;
+      for (; old.cursor < words && budget > 0; ++old.cursor) {
+        uint64_t bits = old.built[old.cursor];
+        budget -= std::min<size_t>(budget, 1 + __builtin_popcountll(bits));
+        for (; bits != 0; bits &= bits - 1) {
+          moveSlot(&old, old.cursor * 64 + __builtin_ctzll(bits));
+        }
+      }
+      discard(old, first * 64, std::min(old.cursor * 64, old.capacity));
+      if (old.cursor < words) {
+        break;
+      }
+      // all elements are moved, so that nothing to destroy.
+      deallocate(&old);
+      olds.erase(olds.begin());
+    }
+    return !olds.empty();
+  }
+  size_t size() const {
+    return hasElements ? distance(minKey, maxKey) + 1 : 0;
+  }
+  bool empty() const {
+    return !hasElements;
+  }
+  template <typename Key>
+  bool contains(const Key& key) const {
+    return hasElements && !(key < minKey) && !(maxKey < key);
+  }
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  const V& at(const Key& key) const {
+    if (!contains(key)) {
+      throw std::out_of_range("key not found");
+    }
+    return value(static_cast<K>(key));
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  V& at(const Key& key) {
+    if (!contains(key)) {
+      throw std::out_of_range("key not found");
+    }
+    V& value = slot(static_cast<K>(key));
+    migrate(Step);
+    return value;
+  }
+  /**
+   * access or insert specified element.
+   */
+  template <typename Key>
+  V& operator[](const Key& key) {
+    const K k = static_cast<K>(key);
+    grow(k, k);
+    V& value = slot(k);
+    migrate(Step);
+    return value;
+  }
+  /**
+   * inserts element, or assigns its value if key exists.
+   * returns an iterator to the element and true if inserted.
+   * the iterator points to the element until the next growth.
+   */
+  std::pair<iterator, bool> insert(const value_type& value) {
+    const bool inserted = !contains(value.first);
+    const K k = value.first;
+    grow(k, k);
+    slot(k) = value.second;
+    migrate(Step);
+    return std::make_pair(cur.slots + cur.index(k), inserted);
+  }
+  /**
+   * finds element with specific key, moving or constructing it.
+   * the iterator points to the element until the next growth.
+   */
+  template <typename Key>
+  iterator find(const Key& key) {
+    if (!contains(key)) {
+      return hasElements ? cur.slots + cur.index(maxKey) + 1 : nullptr;
+    }
+    const K k = static_cast<K>(key);
+    slot(k);
+    migrate(Step);
+    return cur.slots + cur.index(k);
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  const_iterator find(const Key& key) const {
+    if (!contains(key)) {
+      return cend();
+    }
+    return const_iterator(this, distance(minKey, static_cast<K>(key)));
+  }
+  /**
+   * expands the region of elements to contain [low, high].
+   */
+  void reserve(const K& low, const K& high) {
+    grow(low, high);
+    migrate(Step);
+  }
+  /**
+   * removes all elements and releases storage.
+   */
+  void clear() {
+    for (Slots& old : olds) {
+      release(&old);
+    }
+    olds.clear();
+    release(&cur);
+    hasElements = false;
+    dense = true;
+  }
+  /**
+   * returns an iterator to the beginning.
+   * finishes moving elements and constructs elements not written,
+   * so that elements are contiguous.
+   */
+  iterator begin() {
+    materialize();
+    return hasElements ? cur.slots + cur.index(minKey) : nullptr;
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  iterator end() {
+    materialize();
+    return hasElements ? cur.slots + cur.index(maxKey) + 1 : nullptr;
+  }
+  /**
+   * returns an iterator to the beginning.
+   * elements are read in place, so that nothing is moved.
+   */
+  const_iterator begin() const {
+    return cbegin();
+  }
+  const_iterator cbegin() const {
+    return const_iterator(this, 0);
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  const_iterator end() const {
+    return cend();
+  }
+  const_iterator cend() const {
+    return const_iterator(this, size());
+  }
+
+ private:
+  /**
+   * returns high - low without overflow.
+   */
+  static size_t distance(const K& low, const K& high) {
+    return static_cast<size_t>(static_cast<U>(U(high) - U(low)));
+  }
+  /**
+   * slot i holds key (origin + i) if bit i of built is set.
+   */
+  struct Slots {
+    value_type* slots;
+    uint64_t* built;
+    size_t capacity;
+    K origin;
+    /**
+     * elements of words of built before this are moved.
+     */
+    size_t cursor;
+    Slots() : slots(nullptr), built(nullptr), capacity(0), origin(),
+              cursor(0) {}
+    size_t index(const K& key) const {
+      return distance(origin, key);
+    }
+    bool covers(const K& key) const {
+      return !(key < origin) && index(key) < capacity;
+    }
+    bool isBuilt(size_t i) const {
+      return (built[i / 64] >> (i % 64)) & 1;
+    }
+  };
+  Slots cur;
+  /**
+   * old storages from the oldest.
+   */
+  std::vector<Slots> olds;
+  K minKey;
+  K maxKey;
+  bool hasElements;
+  /**
+   * true if all elements of the region are constructed.
+   */
+  bool dense;
+  std::function<void()> onGrow;
+
+  static const V& defaultValue() {
+    static const V value = V();
+    return value;
+  }
+  /**
+   * returns the value of key in the region,
+   * looking into old storage for elements not moved yet.
+   */
+  const V& value(const K& key) const {
+    for (const Slots& old : olds) {
+      if (old.covers(key) && old.isBuilt(old.index(key))) {
+        return old.slots[old.index(key)].second;
+      }
+    }
+    if (cur.isBuilt(cur.index(key))) {
+      return cur.slots[cur.index(key)].second;
+    }
+    return defaultValue();
+  }
+  static size_t wordsOf(size_t capacity) {
+    return (capacity + 63) / 64;
+  }
+  /**
+   * destroys constructed elements and releases storage.
+   */
+  void release(Slots* s) {
+    if (s->slots == nullptr) {
+      return;
+    }
+    const size_t words = wordsOf(s->capacity);
+    for (size_t w = 0; w < words; ++w) {
+      for (uint64_t bits = s->built[w]; bits != 0; bits &= bits - 1) {
+        s->slots[w * 64 + __builtin_ctzll(bits)].~value_type();
+      }
+    }
+    deallocate(s);
+  }
+  /**
+   * releases storage without elements.
+   */
+  void deallocate(Slots* s) {
+    freeSlots(s->slots, s->capacity);
+    freeBits(s->built, s->capacity);
+    *s = Slots();
+  }
+#ifdef __linux__
+  /**
+   * maps anonymous pages, which are zero-filled and owned by this map.
+   */
+  static void* mapPages(size_t bytes) {
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+#endif
+  /**
+   * allocates storage of capacity slots without constructing them.
+   * slots are mapped directly, so that discard() may drop their pages.
+   */
+  static value_type* allocateSlots(size_t capacity) {
+#ifdef __linux__
+    return static_cast<value_type*>(mapPages(capacity * sizeof(value_type)));
+#else
+    return std::allocator<value_type>().allocate(capacity);
+#endif
+  }
+  static void freeSlots(value_type* slots, size_t capacity) {
+#ifdef __linux__
+    munmap(slots, capacity * sizeof(value_type));
+#else
+    std::allocator<value_type>().deallocate(slots, capacity);
+#endif
+  }
+  /**
+   * allocates zero-filled bitmap of capacity bits.
+   * mmap gives zero pages without clearing them,
+   * while calloc may clear memory reused from heap.
+   */
+  static uint64_t* allocateBits(size_t capacity) {
+#ifdef __linux__
+    return static_cast<uint64_t*>(
+      mapPages(wordsOf(capacity) * sizeof(uint64_t)));
+#else
+    void* p = std::calloc(wordsOf(capacity), sizeof(uint64_t));
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return static_cast<uint64_t*>(p);
+#endif
+  }
+  static void freeBits(uint64_t* bits, size_t capacity) {
+#ifdef __linux__
+    munmap(bits, wordsOf(capacity) * sizeof(uint64_t));
+#else
+    (void)capacity;
+    std::free(bits);
+#endif
+  }
+  /**
+   * returns pages of moved slots [first, last) to the kernel,
+   * so that releasing old storage at last does not take long.
+   * slots are mapped by allocateSlots(), so that no allocator
+   * reuses the pages.
+   */
+  static void discard(const Slots& s, size_t first, size_t last) {
+#ifdef __linux__
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t from = reinterpret_cast<uintptr_t>(s.slots + first);
+    const uintptr_t to = reinterpret_cast<uintptr_t>(s.slots + last);
+    // rounds toward inside, since edge pages may be shared.
+    const uintptr_t low = (from + page - 1) / page * page;
+    const uintptr_t high = to / page * page;
+    if (low < high) {
+      madvise(reinterpret_cast<void*>(low), high - low, MADV_DONTNEED);
+    }
+#else
+    (void)s;
+    (void)first;
+    (void)last;
+#endif
+  }
+  /**
+   * moves slot i of old storage to new storage.
+   */
+  void moveSlot(Slots* old, size_t i) {
+    value_type& src = old->slots[i];
+    const size_t j = cur.index(src.first);
+    new (cur.slots + j) value_type(std::move(src));
+    cur.built[j / 64] |= uint64_t(1) << (j % 64);
+    src.~value_type();
+    old->built[i / 64] &= ~(uint64_t(1) << (i % 64));
+  }
+  /**
+   * returns the element of key in the region,
+   * moving or constructing it in new storage.
+   */
+  V& slot(const K& key) {
+    for (Slots& old : olds) {
+      if (old.covers(key) && old.isBuilt(old.index(key))) {
+        moveSlot(&old, old.index(key));
+        break;
+      }
+    }
+    const size_t j = cur.index(key);
+    if (!cur.isBuilt(j)) {
+      new (cur.slots + j) value_type(key, V());
+      cur.built[j / 64] |= uint64_t(1) << (j % 64);
+    }
+    return cur.slots[j].second;
+  }
+  /**
+   * expands the region of elements to contain [low, high].
+   * new slots are not constructed.
+   */
+  void grow(const K& low, const K& high) {
+    const K bottom = hasElements && minKey < low ? minKey : low;
+    const K top = hasElements && high < maxKey ? maxKey : high;
+    if (hasElements && bottom == minKey && top == maxKey) {
+      return;
+    }
+    if (cur.slots == nullptr || !cur.covers(bottom) || !cur.covers(top)) {
+      reallocate(bottom, top, hasElements && bottom < minKey);
+    }
+    minKey = bottom;
+    maxKey = top;
+    hasElements = true;
+    dense = false;
+  }
+  /**
+   * allocates new storage for [bottom, top] with room for growth,
+   * and starts moving elements to it.
+   */
+  void reallocate(const K& bottom, const K& top, bool downward) {
+    const size_t span = distance(bottom, top) + 1;
+    if (span == 0 ||
+        span > std::allocator_traits<std::allocator<value_type> >::max_size(
+          std::allocator<value_type>())) {
+      throw std::length_error("too many elements");
+    }
+    size_t capacity = std::max<size_t>(kMinCapacity, span * 2);
+    if (span > std::numeric_limits<size_t>::max() / 2) {
+      capacity = span;
+    }
+    // room below bottom and above top within K.
+    const size_t below = distance(std::numeric_limits<K>::min(), bottom);
+    const size_t above = distance(top, std::numeric_limits<K>::max());
+    size_t room = capacity - span;
+    if (below < room && above < room - below) {
+      room = below + above;
+      capacity = span + room;
+    }
+    // places room in the direction of growth.
+    size_t roomBelow = downward ? std::min(room, below) : 0;
+    if (room - roomBelow > above) {
+      roomBelow = room - above;
+    }
+    Slots s;
+    s.origin = static_cast<K>(static_cast<U>(U(bottom) - U(roomBelow)));
+    s.capacity = capacity;
+    s.built = allocateBits(capacity);
+    try {
+      s.slots = allocateSlots(capacity);
+    } catch (...) {
+      freeBits(s.built, capacity);
+      throw;
+    }
+    if (cur.slots == nullptr) {
+      cur = s;
+      return;
+    }
+    olds.push_back(cur);
+    cur = s;
+    if (onGrow) {
+      onGrow();
+    }
+  }
+  /**
+   * finishes moving and constructs all elements of the region.
+   */
+  void materialize() {
+    migrate();
+    if (dense) {
+      return;
+    }
+    for (size_t j = cur.index(minKey); j <= cur.index(maxKey); ++j) {
+      if (!cur.isBuilt(j)) {
+        const K key = static_cast<K>(static_cast<U>(U(cur.origin) + j));
+        new (cur.slots + j) value_type(key, V());
+        cur.built[j / 64] |= uint64_t(1) << (j % 64);
+      }
+    }
+    dense = true;
+  }
+  static constexpr size_t kMinCapacity = 64;
+};
+#endif  // INCREMENTALMIMICMAP_H_
@@ -0,0 +1,314 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef INLINEVECTOR_H_
+#define INLINEVECTOR_H_
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+/**
+ * std::vector like sequence container
+ * storing up to N elements inside the object.
+ *
+ * elements are moved to heap only when size exceeds N,
+ * and moved back inside when size shrinks to N or less.
+ */
+template<typename T, size_t N, typename Allocator = std::allocator<T> >
+class InlineVector {
+  static_assert(N > 0, "N must be positive");
+  using traits = std::allocator_traits<Allocator>;
+
+ public:
+  using value_type = T;
+  using allocator_type = Allocator;
+  using size_type = size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  /**
+   * constructs an empty container.
+   */
+  explicit InlineVector(const allocator_type& alloc = allocator_type())
+    : allocator(alloc), first(inlineData()), count(0), capacity_(N) {}
+  /**
+   * constructs with the contents of the range [from, to).
+   */
+  template<typename IT>
+  InlineVector(IT from, IT to,
+               const allocator_type& alloc = allocator_type())
+    : InlineVector(alloc) {
+    for (; from != to; ++from) {
+      emplace_back(*from);
+    }
+  }
+  /**
+   * copy constructor.
+   */
+  InlineVector(const InlineVector& orig)
+    : InlineVector(orig, traits::select_on_container_copy_construction(
+                     orig.allocator)) {}
+  /**
+   * copy constructor with allocator.
+   */
+  InlineVector(const InlineVector& orig, const allocator_type& alloc)
+    : InlineVector(alloc) {
+    reserve(orig.count);
+    for (const T& e : orig) {
+      emplace_back(e);
+    }
+  }
+  /**
+   * move constructor.
+   */
+  InlineVector(InlineVector&& orig) noexcept
+    : allocator(std::move(orig.allocator)),
+      first(inlineData()), count(0), capacity_(N) {
+    steal(orig);
+  }
+  ~InlineVector() {
+    clear();
+  }
+  /**
+   * copy assign operator.
+   */
+  InlineVector& operator=(const InlineVector& orig) {
+    if (this == &orig) {
+      return *this;
+    }
+    clear();
+    if constexpr (traits::propagate_on_container_copy_assignment::value) {
+      allocator = orig.allocator;
+    }
+    reserve(orig.count);
+    for (const T& e : orig) {
+      emplace_back(e);
+    }
+    return *this;
+  }
+  /**
+   * move assign operator.
+   */
+  InlineVector& operator=(InlineVector&& orig) {
+    if (this == &orig) {
+      return *this;
+    }
+    clear();
+    if constexpr (traits::propagate_on_container_move_assignment::value) {
+      allocator = std::move(orig.allocator);
+    }
+    if (allocator == orig.allocator) {
+      steal(orig);
+    } else {
+      reserve(orig.count);
+      for (T& e : orig) {
+        emplace_back(std::move(e));
+      }
+      orig.clear();
+    }
+    return *this;
+  }
+  allocator_type get_allocator() const {
+    return allocator;
+  }
+  size_t size() const {
+    return count;
+  }
+  size_t capacity() const {
+    return capacity_;
+  }
+  bool empty() const {
+    return count == 0;
+  }
+  /**
+   * checks whether elements are stored inside the object.
+   */
+  bool isInline() const {
+    return first == inlineData();
+  }
+  T* data() {
+    return first;
+  }
+  const T* data() const {
+    return first;
+  }
+  T& operator[](size_t i) {
+    return first[i];
+  }
+  const T& operator[](size_t i) const {
+    return first[i];
+  }
+  iterator begin() {
+    return first;
+  }
+  const_iterator begin() const {
+    return first;
+  }
+  const_iterator cbegin() const {
+    return first;
+  }
+  iterator end() {
+    return first + count;
+  }
+  const_iterator end() const {
+    return first + count;
+  }
+  const_iterator cend() const {
+    return first + count;
+  }
+  reverse_iterator rbegin() {
+    return reverse_iterator(end());
+  }
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator crbegin() const {
+    return const_reverse_iterator(end());
+  }
+  reverse_iterator rend() {
+    return reverse_iterator(begin());
+  }
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+  const_reverse_iterator crend() const {
+    return const_reverse_iterator(begin());
+  }
+  /**
+   * allocate storage for n elements.
+   */
+  void reserve(size_t n) {
+    if (n > capacity_) {
+      relocate(traits::allocate(allocator, n), n);
+    }
+  }
+  template<typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (count == capacity_) {
+      reserve(capacity_ * 2);
+    }
+    traits::construct(allocator, first + count, std::forward<Args>(args)...);
+    return first[count++];
+  }
+  void push_back(const T& value) {
+    emplace_back(value);
+  }
+  /**
+   * appends n elements constructed by construct(data),
+   * which builds them in place on [data, data + n) of reserved storage.
+   * if construct throws, it must have destroyed what it built.
+   */
+  template<typename F>
+  void append(size_t n, F construct) {
+    reserve(count + n);
+    construct(first + count);
+    count += n;
+  }
+  /**
+   * removes elements in [from, to).
+   */
+  iterator erase(const_iterator from, const_iterator to) {
+    T* const dst = first + (from - cbegin());
+    T* const src = first + (to - cbegin());
+    T* const last = std::move(src, end(), dst);
+    destroy(last, end());
+    count = last - first;
+    shrink();
+    return first + (from - cbegin());
+  }
+  /**
+   * changes the number of elements.
+   */
+  void resize(size_t n) {
+    if (n < count) {
+      destroy(first + n, end());
+      count = n;
+      shrink();
+      return;
+    }
+    reserve(n);
+    while (count < n) {
+      emplace_back();
+    }
+  }
+  /**
+   * removes all elements and releases heap storage.
+   */
+  void clear() {
+    destroy(begin(), end());
+    count = 0;
+    shrink();
+  }
+  void swap(InlineVector& other) {
+    std::swap(*this, other);
+  }
+
+ private:
+  Allocator allocator;
+  T* first;
+  size_t count;
+  size_t capacity_;
+  alignas(T) unsigned char buffer[N * sizeof(T)];
+
+  T* inlineData() {
+    return reinterpret_cast<T*>(buffer);
+  }
+  const T* inlineData() const {
+    return reinterpret_cast<const T*>(buffer);
+  }
+  void destroy(T* from, T* to) {
+    for (; from != to; ++from) {
+      traits::destroy(allocator, from);
+    }
+  }
+  /**
+   * moves elements to storage of given capacity.
+   */
+  void relocate(T* storage, size_t capacity) {
+    for (size_t i = 0; i < count; ++i) {
+      traits::construct(allocator, storage + i, std::move(first[i]));
+      traits::destroy(allocator, first + i);
+    }
+    if (!isInline()) {
+      traits::deallocate(allocator, first, capacity_);
+    }
+    first = storage;
+    capacity_ = capacity;
+  }
+  /**
+   * moves elements back inside the object if possible.
+   */
+  void shrink() {
+    if (!isInline() && count <= N) {
+      relocate(inlineData(), N);
+    }
+  }
+  /**
+   * takes elements of other container with the same allocator.
+   */
+  void steal(InlineVector& other) {
+    assert(empty() && isInline());
+    if (other.isInline()) {
+      for (T& e : other) {
+        emplace_back(std::move(e));
+      }
+      other.clear();
+      return;
+    }
+    first = other.first;
+    count = other.count;
+    capacity_ = other.capacity_;
+    other.first = other.inlineData();
+    other.count = 0;
+    other.capacity_ = N;
+  }
+};
+#endif  // INLINEVECTOR_H_
@@ -0,0 +1,584 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef MAPSTREAM_H_
+#define MAPSTREAM_H_
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Serialize.h"
+
+/**
+ * map stream format.
+ *
+ * uint32_t magic, uint32_t version,
+ * uint32_t sizeof(K), uint32_t sizeof(V),
+ * uint64_t size (the number of elements),
+ * K low, K high (the minimum and maximum keys, only if size > 0),
+ * chunks of { K base, uint64_t n (> 0), V values[n] }
+ * holding keys [base, base + n),
+ * and K base, uint64_t 0 as the end.
+ * values are stored in native byte order.
+ */
+namespace map_stream {
+static constexpr uint32_t kMagic = 0x53444d4d;  // "MMDS"
+static constexpr uint32_t kVersion = 1;
+/**
+ * bytes of values in a chunk written by dumpMap.
+ */
+static constexpr size_t kChunkBytes = 1 << 20;
+/**
+ * bytes of text read at once by loadMapCsv.
+ */
+static constexpr size_t kTextBytes = 4 << 20;
+
+inline void writeAll(std::ostream& out, const char* p, size_t n) {
+  out.write(p, static_cast<std::streamsize>(n));
+  if (!out) {
+    throw std::runtime_error("write failed");
+  }
+}
+using serialize::writeAll;
+/**
+ * reads up to n bytes, fewer only at the end of input.
+ * returns the number of bytes read.
+ */
+inline size_t readSome(std::istream& in, char* p, size_t n) {
+  in.read(p, static_cast<std::streamsize>(n));
+  if (in.bad()) {
+    throw std::runtime_error("read failed");
+  }
+  return static_cast<size_t>(in.gcount());
+}
+inline size_t readSome(int fd, char* p, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    const ssize_t r = ::read(fd, p + done, n - done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r < 0) {
+      throw std::system_error(errno, std::generic_category(), "read");
+    }
+    if (r == 0) {
+      break;
+    }
+    done += static_cast<size_t>(r);
+  }
+  return done;
+}
+template<typename In, typename T>
+void read(In& in, T* value) {
+  if (readSome(in, reinterpret_cast<char*>(value), sizeof(T)) != sizeof(T)) {
+    throw std::runtime_error("truncated stream");
+  }
+}
+/**
+ * returns high - low without overflow.
+ */
+template<typename K>
+size_t distance(const K& low, const K& high) {
+  using U = typename std::make_unsigned<K>::type;
+  return static_cast<size_t>(static_cast<U>(U(high) - U(low)));
+}
+inline size_t defaultThreads(size_t threads) {
+  if (threads > 0) {
+    return threads;
+  }
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+/**
+ * bounded queue from a producer thread to consumer threads.
+ */
+template<typename T>
+class Queue {
+ public:
+  explicit Queue(size_t limit)
+    : capacity(limit), closed(false), cancelled(false) {}
+  /**
+   * waits for room and appends item.
+   * returns false if cancelled.
+   */
+  bool push(T&& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this]() {
+      return cancelled || items.size() < capacity;
+    });
+    if (cancelled) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+  /**
+   * waits for an item and removes it.
+   * returns false if closed and empty, or cancelled.
+   */
+  bool pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this]() {
+      return cancelled || closed || !items.empty();
+    });
+    if (cancelled || items.empty()) {
+      return false;
+    }
+    *item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+  /**
+   * tells consumers that no more items come.
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+  }
+  /**
+   * stops the producer and consumers.
+   */
+  void cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cancelled = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+  bool cancelled;
+};
+
+/**
+ * runs produce(&queue) on a thread reading input ahead,
+ * and consume(&item) on threads threads.
+ * rethrows the first exception after all threads finish.
+ */
+template<typename T, typename Produce, typename Consume>
+void pipeline(size_t threads, Produce produce, Consume consume) {
+  Queue<T> queue(threads * 2);
+  std::mutex mutex;
+  std::exception_ptr error;
+  const auto guard = [&](auto f) {
+    try {
+      f();
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      queue.cancel();
+    }
+  };
+  std::thread reader([&]() {
+    guard([&]() { produce(&queue); });
+    queue.close();
+  });
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      guard([&]() {
+        T item;
+        while (queue.pop(&item)) {
+          consume(&item);
+        }
+      });
+    });
+  }
+  reader.join();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * reserves keys [low, high] in m under any bounds policy of m.
+ *
+ * exceptions:
+ *   std::out_of_range if keys exceed limits of m.
+ */
+template<typename Map, typename K>
+void reserve(Map* m, const K& low, const K& high) {
+  if constexpr (std::is_void<decltype(m->reserve(low, high))>::value) {
+    m->reserve(low, high);
+  } else if (!m->reserve(low, high)) {
+    throw std::out_of_range("keys exceed limits");
+  }
+  // slots of the keys are written without further checks.
+  if (m->empty() || low < (*m->begin()).first ||
+      (*m->rbegin()).first < high) {
+    throw std::out_of_range("keys exceed limits");
+  }
+}
+/**
+ * values of keys [base, base + n).
+ */
+template<typename K>
+struct Chunk {
+  K base;
+  uint64_t n;
+  std::vector<char> values;
+};
+
+template<typename Map, typename Out>
+void dump(const Map& m, Out& out) {
+  using K = typename Map::key_type;
+  using V = typename Map::mapped_type;
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(std::is_trivially_copyable<V>::value,
+                "V must be trivially copyable");
+  constexpr uint64_t kChunkValues =
+    sizeof(V) < kChunkBytes ? kChunkBytes / sizeof(V) : 1;
+  std::vector<char> buffer;
+  serialize::put(&buffer, kMagic);
+  serialize::put(&buffer, kVersion);
+  serialize::put(&buffer, static_cast<uint32_t>(sizeof(K)));
+  serialize::put(&buffer, static_cast<uint32_t>(sizeof(V)));
+  serialize::put(&buffer, static_cast<uint64_t>(m.size()));
+  if (m.size() > 0) {
+    serialize::put(&buffer, (*m.begin()).first);
+    serialize::put(&buffer, (*m.rbegin()).first);
+  }
+  writeAll(out, buffer.data(), buffer.size());
+  constexpr size_t kHeader = sizeof(K) + sizeof(uint64_t);
+  buffer.resize(kHeader + kChunkValues * sizeof(V));
+  // a chunk ends at kChunkValues values or a gap of keys.
+  auto iter = m.begin();
+  while (iter != m.end()) {
+    const K base = (*iter).first;
+    char* p = buffer.data() + kHeader;
+    uint64_t n = 0;
+    do {
+      std::memcpy(p, &(*iter).second, sizeof(V));
+      p += sizeof(V);
+      ++n;
+      ++iter;
+    } while (iter != m.end() && n < kChunkValues &&
+             distance(base, (*iter).first) == n);
+    std::memcpy(buffer.data(), &base, sizeof(K));
+    std::memcpy(buffer.data() + sizeof(K), &n, sizeof(n));
+    writeAll(out, buffer.data(), static_cast<size_t>(p - buffer.data()));
+  }
+  const K end = K();
+  const uint64_t zero = 0;
+  std::memcpy(buffer.data(), &end, sizeof(K));
+  std::memcpy(buffer.data() + sizeof(K), &zero, sizeof(zero));
+  writeAll(out, buffer.data(), kHeader);
+}
+
+template<typename Map, typename In>
+void load(In& in, Map* m, size_t threads) {
+  using K = typename Map::key_type;
+  using V = typename Map::mapped_type;
+  using value_type = typename Map::value_type;
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(std::is_trivially_copyable<V>::value,
+                "V must be trivially copyable");
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t keySize = 0;
+  uint32_t valueSize = 0;
+  uint64_t size = 0;
+  read(in, &magic);
+  read(in, &version);
+  read(in, &keySize);
+  read(in, &valueSize);
+  if (magic != kMagic || version != kVersion ||
+      keySize != sizeof(K) || valueSize != sizeof(V)) {
+    throw std::runtime_error("not a map stream of this type");
+  }
+  read(in, &size);
+  K low = K();
+  K high = K();
+  if (size > 0) {
+    read(in, &low);
+    read(in, &high);
+    if (high < low || distance(low, high) < size - 1) {
+      throw std::runtime_error("corrupt stream");
+    }
+    reserve(m, low, high);
+  }
+  // elements do not move after reserve.
+  value_type* slots = size > 0 ? &*m->begin() : nullptr;
+  const K origin = size > 0 ? (*m->begin()).first : K();
+  std::mutex mutex;
+  std::vector<std::vector<char> > spares;
+  pipeline<Chunk<K> >(
+    defaultThreads(threads),
+    [&](Queue<Chunk<K> >* queue) {
+      uint64_t total = 0;
+      for (;;) {
+        Chunk<K> chunk;
+        read(in, &chunk.base);
+        read(in, &chunk.n);
+        if (chunk.n == 0) {
+          break;
+        }
+        if (size - total < chunk.n || chunk.base < low ||
+            high < chunk.base || distance(chunk.base, high) < chunk.n - 1) {
+          throw std::runtime_error("corrupt stream");
+        }
+        total += chunk.n;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!spares.empty()) {
+            chunk.values.swap(spares.back());
+            spares.pop_back();
+          }
+        }
+        chunk.values.resize(chunk.n * sizeof(V));
+        if (readSome(in, chunk.values.data(), chunk.values.size()) !=
+            chunk.values.size()) {
+          throw std::runtime_error("truncated stream");
+        }
+        if (!queue->push(std::move(chunk))) {
+          return;
+        }
+      }
+      if (total != size) {
+        throw std::runtime_error("corrupt stream");
+      }
+    },
+    [&](Chunk<K>* chunk) {
+      value_type* slot = slots + distance(origin, chunk->base);
+      const char* value = chunk->values.data();
+      for (uint64_t i = 0; i < chunk->n; ++i, value += sizeof(V)) {
+        std::memcpy(static_cast<void*>(&slot[i].second), value, sizeof(V));
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      spares.push_back(std::move(chunk->values));
+    });
+}
+
+/**
+ * a block of whole lines of text.
+ */
+struct Text {
+  size_t sequence;
+  std::string lines;
+};
+
+inline const char* skipSpaces(const char* p, const char* end) {
+  while (p != end && (*p == ' ' || *p == '\t')) {
+    ++p;
+  }
+  return p;
+}
+/**
+ * parses "key,value" in [p, end).
+ * returns false if the line is not a record.
+ */
+template<typename K, typename V>
+bool parseLine(const char* p, const char* end, K* key, V* value) {
+  p = skipSpaces(p, end);
+  const std::from_chars_result k = std::from_chars(p, end, *key);
+  if (k.ec != std::errc()) {
+    return false;
+  }
+  p = skipSpaces(k.ptr, end);
+  if (p == end || *p != ',') {
+    return false;
+  }
+  p = skipSpaces(p + 1, end);
+  const std::from_chars_result v = std::from_chars(p, end, *value);
+  if (v.ec != std::errc()) {
+    return false;
+  }
+  return skipSpaces(v.ptr, end) == end;
+}
+
+template<typename Map, typename In>
+void loadCsv(In& in, Map* m, size_t threads) {
+  using K = typename Map::key_type;
+  using V = typename Map::mapped_type;
+  using value_type = typename Map::value_type;
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(std::is_arithmetic<V>::value, "V must be arithmetic");
+  std::mutex mutex;
+  std::map<size_t, std::vector<std::pair<K, V> > > parsed;
+  size_t next = 0;
+  // writes parsed blocks in order, so that later lines win.
+  const auto apply = [&](const std::vector<std::pair<K, V> >& records) {
+    if (records.empty()) {
+      return;
+    }
+    K low = records.front().first;
+    K high = records.front().first;
+    for (const std::pair<K, V>& r : records) {
+      low = r.first < low ? r.first : low;
+      high = high < r.first ? r.first : high;
+    }
+    reserve(m, low, high);
+    value_type* slots = &*m->begin();
+    const K origin = (*m->begin()).first;
+    for (const std::pair<K, V>& r : records) {
+      slots[distance(origin, r.first)].second = r.second;
+    }
+  };
+  pipeline<Text>(
+    defaultThreads(threads),
+    [&](Queue<Text>* queue) {
+      std::string rest;
+      for (size_t sequence = 0;; ++sequence) {
+        Text text{sequence, std::move(rest)};
+        const size_t kept = text.lines.size();
+        text.lines.resize(kept + kTextBytes);
+        const size_t n = readSome(in, &text.lines[kept], kTextBytes);
+        text.lines.resize(kept + n);
+        if (n == kTextBytes) {
+          // carries the incomplete last line to the next block.
+          const size_t eol = text.lines.rfind('\n');
+          rest.assign(eol == std::string::npos ? text.lines :
+                      text.lines.substr(eol + 1));
+          text.lines.resize(eol == std::string::npos ? 0 : eol + 1);
+        } else {
+          rest.clear();
+        }
+        if (!queue->push(std::move(text))) {
+          return;
+        }
+        if (n < kTextBytes) {
+          return;
+        }
+      }
+    },
+    [&](Text* text) {
+      std::vector<std::pair<K, V> > records;
+      const char* p = text->lines.data();
+      const char* const end = p + text->lines.size();
+      bool first = text->sequence == 0;
+      while (p != end) {
+        const char* eol = static_cast<const char*>(
+          std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char* const nextLine = eol == nullptr ? end : eol + 1;
+        if (eol == nullptr) {
+          eol = end;
+        }
+        if (eol != p && eol[-1] == '\r') {
+          --eol;
+        }
+        std::pair<K, V> r;
+        if (skipSpaces(p, eol) != eol) {
+          if (parseLine(p, eol, &r.first, &r.second)) {
+            records.push_back(r);
+          } else if (!first) {
+            throw std::runtime_error(
+              "bad csv line: " + std::string(p, eol));
+          }
+          // the first line may be a header.
+          first = false;
+        }
+        p = nextLine;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      parsed.emplace(text->sequence, std::move(records));
+      while (!parsed.empty() && parsed.begin()->first == next) {
+        apply(parsed.begin()->second);
+        parsed.erase(parsed.begin());
+        ++next;
+      }
+    });
+}
+}  // namespace map_stream
+
+/**
+ * writes elements of m to out in map stream format.
+ * a chunk holds values of consecutive keys,
+ * so that gaps of sparse containers are not written.
+ *
+ * exceptions:
+ *   std::runtime_error if writing fails.
+ */
+template<typename Map>
+void dumpMap(const Map& m, std::ostream& out) {
+  map_stream::dump(m, out);
+}
+/**
+ * writes elements of m to file descriptor fd in map stream format.
+ *
+ * exceptions:
+ *   std::system_error if writing fails.
+ */
+template<typename Map>
+void dumpMap(const Map& m, int fd) {
+  map_stream::dump(m, fd);
+}
+/**
+ * reads elements written by dumpMap into m.
+ * the region of elements is reserved at once from the header,
+ * and chunks read ahead by a thread are copied to their slots
+ * by threads threads (hardware concurrency if 0).
+ * keys between chunks keep values in m.
+ *
+ * exceptions:
+ *   std::runtime_error if the input is not a valid map stream.
+ *   std::out_of_range if keys exceed limits of m.
+ */
+template<typename Map>
+void loadMap(std::istream& in, Map* m, size_t threads = 0) {
+  map_stream::load(in, m, threads);
+}
+/**
+ * reads elements written by dumpMap from file descriptor fd into m.
+ *
+ * exceptions:
+ *   std::system_error if reading fails.
+ *   std::runtime_error if the input is not a valid map stream.
+ *   std::out_of_range if keys exceed limits of m.
+ */
+template<typename Map>
+void loadMap(int fd, Map* m, size_t threads = 0) {
+  map_stream::load(fd, m, threads);
+}
+/**
+ * reads "key,value" lines into m.
+ * blocks of lines are parsed by threads threads, and written
+ * in order of lines, reserving the keys of each block at once.
+ * sorted keys grow m at the end.
+ * the first line is skipped if it is not a record, as a header.
+ *
+ * exceptions:
+ *   std::runtime_error if a line is not a record.
+ *   std::out_of_range if keys exceed limits of m.
+ */
+template<typename Map>
+void loadMapCsv(std::istream& in, Map* m, size_t threads = 0) {
+  map_stream::loadCsv(in, m, threads);
+}
+/**
+ * reads "key,value" lines from file descriptor fd into m.
+ */
+template<typename Map>
+void loadMapCsv(int fd, Map* m, size_t threads = 0) {
+  map_stream::loadCsv(fd, m, threads);
+}
+#endif  // MAPSTREAM_H_
@@ -0,0 +1,787 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "MimicMap.h"
+#include "RigidMap.h"
+#include "PackedMap.h"
+#include "FrozenMap.h"
+#include "CombinableMap.h"
+#include "Checkpoint.h"
+#include "RangeKernels.h"
+#include "IncrementalMimicMap.h"
+#include "SharedMimicMap.h"
+#include "SparseMap.h"
+#include "MapStream.h"
+
+/**
+ * checks that expr throws exception E.
+ */
+#define EXPECT_THROW(expr, E)                   \
+  do {                                          \
+    bool thrown = false;                        \
+    try {                                       \
+      (void)(expr);                             \
+    } catch (const E&) {                        \
+      thrown = true;                            \
+    }                                           \
+    assert(thrown);                             \
+    (void)thrown;                               \
+  } while (0)
+
+void testMimicMap() {
+  MimicMap<int, int> m;
+  assert(m.empty());
+  m[3] = 30;
+  m[-2] = -20;
+  assert(m.size() == 6);
+  assert(m.begin()->first == -2 && m.rbegin()->first == 3);
+  assert(m.at(3) == 30 && m.at(0) == 0);
+  EXPECT_THROW(m.at(4), std::out_of_range);
+  const std::pair<MimicMap<int, int>::iterator, bool> r =
+    m.insert(std::make_pair(3, 31));
+  assert(!r.second && r.first->second == 31);
+  m.setHigherLimit(5);
+  EXPECT_THROW(m[6], std::out_of_range);
+}
+
+void testRigidMap() {
+  RigidMap<int, int> m;
+  m.setLowerLimit(0).setHigherLimit(9);
+  assert(m.size() == 10);
+  m[9] = 1;
+  EXPECT_THROW(m[10], std::out_of_range);
+  EXPECT_THROW(m[-1], std::out_of_range);
+}
+
+void testPackedMap() {
+  BitMap<int> bits;
+  bits[100] = true;
+  bits[-27] = true;
+  assert(bits.size() == 128);
+  assert(bits.at(100) && bits.at(-27) && !bits.at(0));
+  assert(bits.countValue(true) == 2);
+  assert(bits.findValue(true) == bits.find(-27));
+  assert(bits.findValue(true, -26) == bits.find(100));
+  assert(bits.findValue(true, 101) == bits.end());
+  PackedMap<unsigned, unsigned, 4> nibbles;
+  for (unsigned k = 0; k < 200; ++k) {
+    nibbles[k] = k % 16;
+  }
+  assert(nibbles.countValue(15) == 12);
+  for (unsigned k = 0; k < 200; ++k) {
+    assert(nibbles.at(k) == k % 16);
+  }
+  EXPECT_THROW(nibbles[0u] = 16u, std::out_of_range);
+  const std::pair<PackedMap<unsigned, unsigned, 4>::iterator, bool> r =
+    nibbles.insert(std::make_pair(5u, 1u));
+  assert(!r.second && nibbles.at(5u) == 1);
+  // an inverted range allocates nothing.
+  BitMap<int> inverted;
+  inverted.reserve(10, 5);
+  assert(inverted.empty() && inverted.size() == 0);
+  inverted[7] = true;
+  assert(inverted.size() == 1 && inverted.at(7));
+  RigidBitMap<int> rigid;
+  rigid.setLowerLimit(0).setHigherLimit(63);
+  rigid[63] = true;
+  EXPECT_THROW(rigid[64], std::out_of_range);
+}
+
+void testFrozenMap() {
+  MimicMap<int, int> m;
+  m[-100] = 7;
+  for (int k = 0; k < 64; ++k) {
+    m[k] = 5;
+  }
+  for (int k = 64; k < 200; ++k) {
+    m[k] = 1000 + k;
+  }
+  m[1000] = -1;
+  const FrozenMap<int, int> f = freeze(m);
+  assert(f.size() == m.size());
+  assert(f.compressedSize() < m.size() * sizeof(int));
+  for (const std::pair<int, int>& e : m) {
+    assert(f.contains(e.first) && f.at(e.first) == e.second);
+  }
+  assert(f.find(1001) == f.end());
+  EXPECT_THROW(f.at(-101), std::out_of_range);
+  const MimicMap<int, int> t = f.thaw();
+  assert(t.size() == m.size());
+  assert(std::equal(t.begin(), t.end(), m.begin()));
+  // offsets of 2 and 4 bytes.
+  MimicMap<int, long> wide;
+  for (int k = 0; k < 128; ++k) {
+    wide[k] = k < 64 ? 1000L * k : 100000000L * (k % 7);
+  }
+  const FrozenMap<int, long> fw = freeze(wide);
+  assert(fw.compressedSize() < wide.size() * sizeof(long));
+  assert(std::equal(fw.begin(), fw.end(), wide.begin()));
+  // 1 byte values not compressing are no larger than raw values.
+  MimicMap<int, unsigned char> noise;
+  for (int k = 0; k < 1000; ++k) {
+    noise[k] = static_cast<unsigned char>(k * 7919 % 251);
+  }
+  const FrozenMap<int, unsigned char> fn = freeze(noise);
+  assert(fn.compressedSize() <= noise.size());
+  assert(std::equal(fn.begin(), fn.end(), noise.begin()));
+  assert(fn.at(999) == noise.at(999));
+  const FrozenMap<int, int> e = freeze(MimicMap<int, int>());
+  assert(e.empty() && e.begin() == e.end());
+}
+
+// tables built at compile time.
+constexpr auto kConsecutive =
+  makeFrozenMap<int, int>({{200, 0}, {202, 2}, {201, 1}});
+static_assert(kConsecutive.size() == 3);
+static_assert(kConsecutive.at(201) == 1 && kConsecutive.at(202) == 2);
+constexpr auto kSparse = makeFrozenMap<int, int, 3>({{1, 10}, {3, 30}});
+static_assert(kSparse.size() == 3 && kSparse.at(3) == 30);
+static_assert(kSparse.at(2) == 0 && !kSparse.contains(4));
+constexpr auto kOverwritten = makeFrozenMap<int, char>({{5, 'a'}, {5, 'b'}});
+static_assert(kOverwritten.size() == 1 && kOverwritten.at(5) == 'b');
+constexpr auto kNegative =
+  makeFrozenMap<long, long, 10>({{-5, 1}, {4, 2}, {0, 3}});
+static_assert(kNegative.begin()->first == -5 && kNegative.at(0) == 3);
+
+void testMakeFrozenMap() {
+  // keys spanning more than Span fail.
+  const std::pair<int, int> elements[] = {{0, 1}, {5, 2}};
+  EXPECT_THROW((makeFrozenMap<int, int, 5>(elements)), std::length_error);
+  const FixedMap<int, int, 6> m = makeFrozenMap<int, int, 6>(elements);
+  assert(m.size() == 6 && m.at(5) == 2);
+}
+
+void testMergeWith() {
+  MimicMap<int, int> a;
+  a[0] = 1;
+  a[4] = 2;
+  MimicMap<int, int> b;
+  b[3] = 10;
+  b[8] = 20;
+  const MimicMap<int, int> c = combine(a, b, std::plus<int>());
+  assert(c.size() == 9);
+  assert(c.at(0) == 1 && c.at(3) == 10 && c.at(4) == 2 && c.at(8) == 20);
+  a.mergeWith(b, std::plus<int>());
+  assert(std::equal(a.begin(), a.end(), c.begin()));
+  MimicMap<int, int> limited;
+  limited.setHigherLimit(5);
+  limited[0] = 1;
+  EXPECT_THROW(limited.mergeWith(b, std::plus<int>()), std::out_of_range);
+  assert(limited.size() == 1);
+}
+
+void testFirstTouch() {
+  FirstTouchPolicy policy(FirstTouchPolicy::kInterleave, 3);
+  policy.chunkBytes = 0;
+  policy.minParallelBytes = 0;
+  // parts cover the range exactly once from an unaligned address.
+  std::vector<char> bytes(5 * first_touch::pageSize() + 3);
+  std::vector<int> visits(bytes.size());
+  firstTouch(bytes.data() + 3, bytes.size() - 3, policy,
+             [&](size_t first, size_t last) {
+               for (size_t i = first; i < last; ++i) {
+                 ++visits[i];
+               }
+             });
+  assert(std::count(visits.begin(), visits.end() - 3, 1) ==
+         static_cast<long>(bytes.size() - 3));
+  // parts are visited in order if asked, and errors reach the caller.
+  size_t next = 0;
+  firstTouch(bytes.data() + 3, bytes.size() - 3, policy,
+             [&](size_t first, size_t last) {
+               assert(first == next);
+               next = last;
+             }, true);
+  assert(next == bytes.size() - 3);
+  EXPECT_THROW(firstTouch(bytes.data(), bytes.size(), policy,
+                          [](size_t first, size_t) {
+                            if (first > 0) {
+                              throw std::runtime_error("visit");
+                            }
+                          }), std::runtime_error);
+  // inline storage is built in place by the workers.
+  SmallMimicMap<int, long, 4> small;
+  small.reserve(-1000, 20000, policy);
+  assert(small.size() == 21001 && small.at(20000) == 0);
+  small[7] = 70;
+  small.reserve(-3000, 30000, policy);
+  assert(small.size() == 33001 && small.at(7) == 70 && small.at(-3000) == 0);
+  MimicMap<int, long> m;
+  m.reserve(-1000, 20000, policy);
+  assert(m.size() == 21001);
+  assert(m.begin()->first == -1000 && m.rbegin()->first == 20000);
+  m[7] = 70;
+  policy.placement = FirstTouchPolicy::kPartition;
+  m.reserve(-30000, 30000, policy);
+  assert(m.size() == 60001);
+  long key = -30000;
+  for (const std::pair<int, long>& e : m) {
+    assert(e.first == key++);
+    assert(e.second == (e.first == 7 ? 70 : 0));
+  }
+  MimicMap<int, long> limited;
+  limited.setHigherLimit(10);
+  EXPECT_THROW(limited.reserve(0, 11, policy), std::out_of_range);
+}
+
+void testPmr() {
+  char buffer[4096];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer),
+                                            std::pmr::null_memory_resource());
+  pmr::MimicMap<int, int> m(&arena);
+  m[3] = 30;
+  m[-3] = -30;
+  assert(m.size() == 7);
+  assert(m.get_allocator().resource() == &arena);
+  const pmr::MimicMap<int, int> copy(m, &arena);
+  assert(copy.get_allocator().resource() == &arena);
+  assert(std::equal(copy.begin(), copy.end(), m.begin()));
+  pmr::MimicMap<int, int> moved(std::move(m));
+  assert(moved.get_allocator().resource() == &arena && moved.at(3) == 30);
+  pmr::RigidMap<int, int> r(&arena);
+  r.setLowerLimit(0).setHigherLimit(9);
+  assert(r.size() == 10 && r.get_allocator().resource() == &arena);
+  // the arena refuses to grow beyond its buffer,
+  // and expanding downward keeps elements on failure.
+  EXPECT_THROW(moved.reserve(-100000, 0), std::bad_alloc);
+  assert(moved.size() == 7 && moved.at(-3) == -30);
+}
+
+void testSmallMap() {
+  using Inline = SmallMimicMap<
+    int, int, 8, std::pmr::polymorphic_allocator<std::pair<int, int> > >;
+  // elements up to N never touch the heap.
+  Inline m(std::pmr::null_memory_resource());
+  m[0] = 1;
+  m[7] = 8;
+  assert(m.size() == 8 && m.at(7) == 8);
+  EXPECT_THROW(m[8], std::bad_alloc);
+  SmallMimicMap<int, int, 4> s;
+  for (int k = 0; k < 100; ++k) {
+    s[k] = k;
+  }
+  const SmallMimicMap<int, int, 4> copy = s;
+  SmallMimicMap<int, int, 4> moved = std::move(s);
+  assert(moved.size() == 100 && moved.at(99) == 99);
+  assert(std::equal(copy.begin(), copy.end(), moved.begin()));
+  SmallMimicMap<int, int, 4> few;
+  few[-1] = 5;
+  few.swap(moved);
+  assert(few.size() == 100 && moved.size() == 1 && moved.at(-1) == 5);
+  SmallRigidMap<int, int, 4> r;
+  r.setLowerLimit(0).setHigherLimit(3);
+  r[3] = 3;
+  EXPECT_THROW(r[4], std::out_of_range);
+}
+
+void testCombinableMap() {
+  CombinableMap<int, long> histogram;
+  assert(histogram.reduce(std::plus<long>()).empty());
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; ++t) {
+    workers.emplace_back([&histogram, t]() {
+        MimicMap<int, long>& local = histogram.local();
+        for (int k = t * 100000; k < 200000 + t * 100000; ++k) {
+          ++local[k % 300000];
+        }
+      });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  size_t maps = 0;
+  histogram.combineEach([&maps](const MimicMap<int, long>&) { ++maps; });
+  assert(maps == 4);
+  // parallel and serial reductions agree.
+  const MimicMap<int, long> total = histogram.reduce(std::plus<long>(), 4);
+  const MimicMap<int, long> serial = histogram.reduce(std::plus<long>(), 1);
+  assert(total.size() == 300000);
+  assert(std::equal(total.begin(), total.end(), serial.begin()));
+  long sum = 0;
+  for (const std::pair<int, long>& e : total) {
+    sum += e.second;
+  }
+  assert(sum == 800000);
+  histogram.clear();
+  histogram.local()[5] = 1;
+  assert(histogram.reduce(std::plus<long>()).size() == 1);
+  // maps of the same type used alternately keep their own locals.
+  CombinableMap<int, long> other;
+  for (int k = 0; k < 10; ++k) {
+    ++histogram.local()[k];
+    --other.local()[k];
+  }
+  assert(&histogram.local() != &other.local());
+  assert(histogram.local().at(5) == 2 && other.local().at(5) == -1);
+  assert(other.reduce(std::plus<long>()).size() == 10);
+}
+
+void testBoundsPolicy() {
+  using Optional = BasicMap<int, int, GrowBothEnds, ReturnOptional>;
+  using RigidOptional = BasicMap<int, int, FixedRange, ReturnOptional>;
+  Optional b;
+  b[3]->get() = 10;
+  b[8]->get() = 20;
+  // combining into an empty map of fixed range fails.
+  assert(!combine(RigidOptional(), RigidOptional(b.begin(), b.end()),
+                  std::plus<int>()).has_value());
+  Optional limited;
+  limited.setHigherLimit(5);
+  assert(!combine(limited, b, std::plus<int>()).has_value());
+  assert(!limited.mergeWith(b, std::plus<int>()) && limited.empty());
+  assert(!limited[6].has_value());
+  assert(limited[5].has_value() && limited.size() == 1);
+  const std::optional<Optional> c = combine(b, b, std::plus<int>());
+  assert(c.has_value() && c->at(8).value().get() == 40);
+  MimicMap<int, int> throwing;
+  throwing.setHigherLimit(5);
+  EXPECT_THROW(combine(throwing, MimicMap<int, int>(b.begin(), b.end()),
+                       std::plus<int>()),
+               std::out_of_range);
+  BasicMap<int, int, SlidingWindow<4> > window;
+  window[0] = 1;
+  window[9] = 2;
+  assert(window.size() == 4 && window.begin()->first == 6);
+  // reserving an inverted range leaves an empty map empty.
+  MimicMap<int, int> inverted;
+  inverted.reserve(10, 5);
+  inverted.reserve(10, 5, FirstTouchPolicy());
+  assert(inverted.empty());
+  Optional invertedOptional;
+  assert(invertedOptional.reserve(10, 5) && invertedOptional.empty());
+  BasicMap<int, int, SlidingWindow<4> > invertedWindow;
+  invertedWindow.reserve(10, 5);
+  assert(invertedWindow.empty());
+}
+
+void testCheckpoint() {
+  const std::string path = "/tmp/MapTest.checkpoint";
+  std::remove(path.c_str());
+  {
+    CheckpointedMap<int, long, 16> m(path);
+    for (int k = 0; k < 1000; ++k) {
+      m[k] = k;
+    }
+    m.checkpoint();
+    m[500] = -1;
+    m[-10] = -10;
+    m.checkpoint();
+    m.flush();
+  }
+  MimicMap<int, long> loaded = loadCheckpoint<int, long>(path);
+  assert(loaded.size() == 1010);
+  assert(loaded.at(-10) == -10 && loaded.at(500) == -1 &&
+         loaded.at(999) == 999 && loaded.at(0) == 0);
+  {
+    // elements regrown after clear() do not keep old values.
+    CheckpointedMap<int, long, 16> m(path);
+    assert(m.size() == 1010 && m.at(999) == 999);
+    m.clear();
+    m[0] = 1;
+    m[999] = 2;
+    m.checkpoint();
+    m.flush();
+  }
+  loaded = loadCheckpoint<int, long>(path);
+  assert(loaded.size() == 1000 && loaded.at(0) == 1 && loaded.at(999) == 2);
+  for (int k = 1; k < 999; ++k) {
+    assert(loaded.at(k) == 0);
+  }
+  {
+    CheckpointedMap<int, long, 16> m(path);
+    m[5] = 5;
+    m.compact();
+    m.flush();
+    m[6] = 6;
+    m.checkpoint();
+    m.flush();
+  }
+  loaded = loadCheckpoint<int, long>(path);
+  assert(loaded.at(5) == 5 && loaded.at(6) == 6 && loaded.at(0) == 1);
+  // an incomplete last record is ignored.
+  const MimicMap<int, long> before = loaded;
+  {
+    CheckpointedMap<int, long, 16> m(path);
+    m[7] = 7;
+    m.checkpoint();
+    m.flush();
+  }
+  FILE* f = std::fopen(path.c_str(), "r+");
+  std::fseek(f, -4, SEEK_END);
+  const long truncated = std::ftell(f);
+  std::fclose(f);
+  assert(::truncate(path.c_str(), truncated) == 0);
+  loaded = loadCheckpoint<int, long>(path);
+  assert(std::equal(loaded.begin(), loaded.end(), before.begin()));
+  std::remove(path.c_str());
+  {
+    // keys trimmed and regrown before the next checkpoint stay reset.
+    CheckpointedMap<int, long, 16> m(path);
+    for (int k = 0; k <= 2000; ++k) {
+      m[k] = 1;
+    }
+    m.checkpoint();
+    m.setLowerLimit(1500);
+    m.setLowerLimit(0);
+    m[0] = 5;
+    const CheckpointedMap<int, long, 16>& live = m;
+    assert(live.at(1000) == 0);
+    m.checkpoint();
+    m.flush();
+  }
+  loaded = loadCheckpoint<int, long>(path);
+  assert(loaded.at(0) == 5 && loaded.at(1000) == 0 && loaded.at(2000) == 1);
+  std::remove(path.c_str());
+  EXPECT_THROW((loadCheckpoint<int, long>(path)), std::system_error);
+  {
+    // writes fail on a full device.
+    CheckpointedMap<int, long> full("/dev/full");
+    full[0] = 1;
+    full.checkpoint();
+    EXPECT_THROW(full.flush(), std::system_error);
+  }
+}
+
+/**
+ * checks range functions against loops over elements.
+ */
+template<typename K, typename V>
+void checkRanges(const MimicMap<K, V>& m, K low, K high, V x) {
+  V least = V();
+  V most = V();
+  K argmax = K();
+  double sum = 0;
+  size_t greater = 0;
+  size_t less = 0;
+  size_t equal = 0;
+  K firstEqual = K();
+  bool found = false;
+  bool any = false;
+  for (const std::pair<K, V>& e : m) {
+    if (e.first < low || high < e.first) {
+      continue;
+    }
+    if (!any || e.second < least) {
+      least = e.second;
+    }
+    if (!any || most < e.second) {
+      most = e.second;
+      argmax = e.first;
+    }
+    any = true;
+    sum += e.second;
+    greater += x < e.second ? 1 : 0;
+    less += e.second < x ? 1 : 0;
+    equal += e.second == x ? 1 : 0;
+    if (!found && e.second == x) {
+      firstEqual = e.first;
+      found = true;
+    }
+  }
+  if (!any) {
+    EXPECT_THROW(minRange(m, low, high), std::out_of_range);
+    EXPECT_THROW(argmaxRange(m, low, high), std::out_of_range);
+  } else {
+    assert(minRange(m, low, high) == least);
+    assert(maxRange(m, low, high) == most);
+    assert(argmaxRange(m, low, high) == argmax);
+  }
+  assert(static_cast<double>(sumRange(m, low, high)) == sum);
+  assert(countIfRange(m, low, high, GreaterThan<V>(x)) == greater);
+  assert(countIfRange(m, low, high, LessThan<V>(x)) == less);
+  assert(countIfRange(m, low, high, EqualTo<V>(x)) == equal);
+  assert(countIfRange(m, low, high, NotEqualTo<V>(x)) ==
+         (any ? static_cast<size_t>(high < m.rbegin()->first ?
+                                    high : m.rbegin()->first) -
+                static_cast<size_t>(low < m.begin()->first ?
+                                    m.begin()->first : low) + 1 : 0) -
+         equal);
+  assert(countIfRange(m, low, high, [x](const V& v) { return x < v; }) ==
+         greater);
+  const typename MimicMap<K, V>::const_iterator it =
+    findFirstIfRange(m, low, high, EqualTo<V>(x));
+  assert(found ? it->first == firstEqual : it == m.end());
+}
+
+void testRangeKernels() {
+  MimicMap<int, int> ints;
+  MimicMap<long, double> doubles;
+  MimicMap<int, float> floats;
+  for (int k = -7; k < 1000; ++k) {
+    ints[k] = (k * 37) % 101;
+    doubles[k] = (k * 13) % 17 * 0.5;
+    floats[k] = static_cast<float>((k * 7) % 11);
+  }
+  ints[613] = 500;
+  const int bounds[][2] = {
+    {-7, 999}, {-100, 2000}, {0, 0}, {3, 34}, {5, 4}, {1000, 1100},
+    {17, 530}, {600, 999},
+  };
+  for (const int (&b)[2] : bounds) {
+    checkRanges(ints, b[0], b[1], 50);
+    checkRanges(ints, b[0], b[1], 500);
+    checkRanges(doubles, static_cast<long>(b[0]), static_cast<long>(b[1]),
+                4.0);
+    checkRanges(floats, b[0], b[1], 3.0f);
+  }
+  assert(argmaxRange(ints, -7, 999) == 613);
+}
+
+void testIncrementalMimicMap() {
+  IncrementalMimicMap<long, long, 16> m;
+  size_t grows = 0;
+  m.setOnGrow([&grows]() { ++grows; });
+  for (long k = 0; k < 1000; ++k) {
+    m[k] = k;
+  }
+  m[-5000] = -1;
+  assert(grows > 0 && m.migrating());
+  // reads find elements not moved yet.
+  const IncrementalMimicMap<long, long, 16>& c = m;
+  assert(c.at(999) == 999 && c.at(0) == 0 && c.at(-1) == 0);
+  EXPECT_THROW(c.at(1000), std::out_of_range);
+  assert(m.size() == 6000);
+  const std::pair<IncrementalMimicMap<long, long, 16>::iterator, bool> r =
+    m.insert(std::make_pair(500L, 7L));
+  assert(!r.second && r.first->first == 500 && r.first->second == 7);
+  const std::pair<IncrementalMimicMap<long, long, 16>::iterator, bool> n =
+    m.insert(std::make_pair(2000L, 8L));
+  assert(n.second && n.first->second == 8 && m.size() == 7001);
+  // const iteration reads in place while elements are being moved.
+  assert(m.migrating() && c.find(999) != c.end() && c.find(2001) == c.cend());
+  assert((*c.find(999)).second == 999 && (*c.begin()).first == -5000);
+  size_t seen = 0;
+  long sum = 0;
+  for (IncrementalMimicMap<long, long, 16>::const_iterator
+         iter = c.cbegin(); iter != c.cend(); ++iter) {
+    ++seen;
+    sum += (*iter).second;
+  }
+  assert(seen == 7001 && sum == 999 * 1000 / 2 - 1 + (7 - 500) + 8);
+  assert(m.find(998)->second == 998 && m.find(998)->first == 998);
+  while (m.migrate(100)) {
+  }
+  assert(!m.migrating() && c.at(500) == 7 && c.at(999) == 999);
+  long key = -5000;
+  for (const std::pair<long, long>& e : m) {
+    assert(e.first == key);
+    assert(e.second == (key == -5000 ? -1 : key == 500 ? 7 :
+                        key == 2000 ? 8 : 0 <= key && key < 1000 ? key : 0));
+    ++key;
+  }
+  assert(key == 2001);
+  assert(m.find(2001) == m.end() && m.find(-5000) == m.begin());
+  IncrementalMimicMap<long, long, 16> moved(std::move(m));
+  assert(m.empty() && moved.size() == 7001 && moved.at(2000) == 8);
+  moved.clear();
+  assert(moved.empty() && moved.begin() == moved.end());
+}
+
+void testSharedMimicMap() {
+  const std::string name = "/MapTest." + std::to_string(::getpid());
+  SharedMimicMap<int, long> writer =
+    SharedMimicMap<int, long>::create(name, -100, 1 << 20);
+  assert(writer.empty());
+  writer.insert_or_assign(10, 100);
+  writer.insert_or_assign(-3, -30);
+  SharedMimicMap<int, long> reader = SharedMimicMap<int, long>::attach(name);
+  assert(reader.size() == 14 && reader.range() == std::make_pair(-3, 10));
+  assert(reader.at(10) == 100 && reader.at(0) == 0);
+  long value = 0;
+  assert(reader.lookup(-3, &value) && value == -30);
+  assert(!reader.lookup(11, &value) && !reader.contains(11));
+  EXPECT_THROW(reader.at(11), std::out_of_range);
+  EXPECT_THROW(reader.insert_or_assign(0, 1), std::logic_error);
+  EXPECT_THROW(writer.insert_or_assign(-101, 1), std::out_of_range);
+  EXPECT_THROW(writer.insert_or_assign(1 << 20 | 1, 1), std::out_of_range);
+  // a reader sees each batch as a whole.
+  bool stop = false;
+  std::thread check([&reader, &stop]() {
+      for (;;) {
+        long first = 0;
+        long last = 0;
+        if (reader.lookup(1000, &first) && reader.lookup(2000, &last)) {
+          assert(first == last);
+        }
+        if (__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+          return;
+        }
+      }
+    });
+  for (long i = 1; i <= 2000; ++i) {
+    const std::pair<int, long> batch[] = {{1000, i}, {2000, i}};
+    writer.insert_or_assign(batch, batch + 2);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  check.join();
+  assert(reader.at(1000) == 2000 && reader.at(2000) == 2000);
+  const uint64_t version = reader.version();
+  writer.reserve(-100, 5000);
+  assert(reader.version() != version && reader.size() == 5101);
+  writer.clear();
+  assert(reader.empty());
+  reader.detach();
+  assert(!reader.attached());
+  SharedMimicMap<int, long>::unlink(name);
+  EXPECT_THROW((SharedMimicMap<int, long>::attach(name)), std::system_error);
+}
+
+void testSparseMap() {
+  std::vector<std::pair<int, int> > table;
+  for (int k = 0; k < 5000; ++k) {
+    table.push_back(std::make_pair(k * 7919 % 100003, k));
+  }
+  SparseMap<int, int> m(table.begin(), table.end());
+  assert(m.isIndexed() && m.size() == table.size());
+  for (const std::pair<int, int>& e : table) {
+    assert(m.at(e.first) == e.second);
+    assert(m.lower_bound(e.first)->first == e.first);
+  }
+  assert(m.find(1) == m.end() && !m.contains(-1));
+  assert(m.lower_bound(100003) == m.end());
+  assert(m.lower_bound(-5) == m.begin());
+  EXPECT_THROW(m.at(1), std::out_of_range);
+  assert(std::is_sorted(m.begin(), m.end()));
+  // insert() assigns existing keys like MimicMap.
+  const std::pair<SparseMap<int, int>::iterator, bool> r =
+    m.insert(std::make_pair(7919, -1));
+  assert(!r.second && r.first->second == -1 && m.at(7919) == -1);
+  const std::pair<SparseMap<int, int>::iterator, bool> n =
+    m.insert(std::make_pair(1, 1));
+  assert(n.second && !m.isIndexed() && m.at(1) == 1);
+  assert(m[1] == 1 && m[2] == 0 && m.size() == table.size() + 2);
+  m.rebuild();
+  assert(m.isIndexed() && m.at(2) == 0 && m.at(7919) == -1);
+  // the last element of a key wins, over existing ones too.
+  const std::pair<int, int> more[] = {{3, 1}, {1, 10}, {3, 2}, {1, 20}};
+  m.insert(more, more + 4);
+  assert(m.at(1) == 20 && m.at(3) == 2 && m.size() == table.size() + 3);
+  assert(std::adjacent_find(m.begin(), m.end(),
+                            [](const std::pair<int, int>& a,
+                               const std::pair<int, int>& b) {
+                              return a.first == b.first;
+                            }) == m.end());
+  m.clear();
+  assert(m.empty() && m.find(1) == m.end());
+}
+
+void testMapStream() {
+  MimicMap<int, double> m;
+  for (int k = -300000; k < 300000; k += 3) {
+    m[k] = k * 0.5;
+  }
+  std::stringstream stream;
+  dumpMap(m, stream);
+  MimicMap<int, double> loaded;
+  loadMap(stream, &loaded, 4);
+  assert(loaded.size() == m.size());
+  assert(std::equal(loaded.begin(), loaded.end(), m.begin()));
+  // through file descriptors.
+  const std::string path = "/tmp/MapTest.stream";
+  const int out = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dumpMap(m, out);
+  ::close(out);
+  const int in = ::open(path.c_str(), O_RDONLY);
+  MimicMap<int, double> fromFd;
+  loadMap(in, &fromFd);
+  ::close(in);
+  std::remove(path.c_str());
+  assert(std::equal(fromFd.begin(), fromFd.end(), m.begin()));
+  // a sparse container writes runs of keys only.
+  SparseMap<int, double> sparse;
+  sparse[5] = 1;
+  sparse[6] = 2;
+  sparse[1000] = 3;
+  std::stringstream sparseStream;
+  dumpMap(sparse, sparseStream);
+  MimicMap<int, double> dense;
+  dense[7] = 9;
+  loadMap(sparseStream, &dense);
+  assert(dense.size() == 996 && dense.at(6) == 2 && dense.at(1000) == 3);
+  assert(dense.at(7) == 9);
+  std::stringstream truncated(stream.str().substr(0, 1000));
+  MimicMap<int, double> partial;
+  EXPECT_THROW(loadMap(truncated, &partial), std::runtime_error);
+  std::stringstream garbage("not a map stream");
+  EXPECT_THROW(loadMap(garbage, &partial), std::runtime_error);
+  // keys beyond limits are not written.
+  stream.clear();
+  stream.seekg(0);
+  BasicMap<int, double, GrowBothEnds, ReturnOptional> optional;
+  optional.setHigherLimit(10);
+  EXPECT_THROW(loadMap(stream, &optional), std::out_of_range);
+  assert(optional.empty());
+  stream.clear();
+  stream.seekg(0);
+  MimicMap<int, double> limited;
+  limited.setLowerLimit(0);
+  EXPECT_THROW(loadMap(stream, &limited), std::out_of_range);
+  assert(limited.empty());
+}
+
+void testMapStreamCsv() {
+  std::stringstream csv;
+  csv << "key,value\n";
+  for (int k = 0; k < 1000000; ++k) {
+    csv << (k % 2 == 0 ? k : -k) << ", " << k % 1000 << "\r\n";
+  }
+  csv << "4,-4\n\n";
+  MimicMap<int, int> m;
+  loadMapCsv(csv, &m, 4);
+  assert(m.size() == 1999998);
+  assert(m.at(-999) == 999 && m.at(6) == 6 && m.at(5) == 0);
+  // the last line of a key wins.
+  assert(m.at(4) == -4);
+  std::stringstream last("1,1\n1,2\n");
+  MimicMap<int, int> overwritten;
+  loadMapCsv(last, &overwritten);
+  assert(overwritten.at(1) == 2);
+  std::stringstream bad("1,1\n2;2\n");
+  MimicMap<int, int> rejected;
+  EXPECT_THROW(loadMapCsv(bad, &rejected), std::runtime_error);
+  std::stringstream far("1,1\n50000,2\n");
+  BasicMap<int, int, GrowBothEnds, ReturnOptional> optional;
+  optional.setHigherLimit(10);
+  EXPECT_THROW(loadMapCsv(far, &optional), std::out_of_range);
+  assert(optional.empty());
+  far.clear();
+  far.seekg(0);
+  MimicMap<int, int> limited;
+  limited.setHigherLimit(10);
+  EXPECT_THROW(loadMapCsv(far, &limited), std::out_of_range);
+}
+
+int main() {
+  testMimicMap();
+  testRigidMap();
+  testPackedMap();
+  testFrozenMap();
+  testMakeFrozenMap();
+  testMergeWith();
+  testFirstTouch();
+  testPmr();
+  testSmallMap();
+  testCombinableMap();
+  testBoundsPolicy();
+  testCheckpoint();
+  testRangeKernels();
+  testIncrementalMimicMap();
+  testSharedMimicMap();
+  testSparseMap();
+  testMapStream();
+  testMapStreamCsv();
+  std::cout << "OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,642 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef PACKEDMAP_H_
+#define PACKEDMAP_H_
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * the sorted associative container for narrow values
+ * (bool or small integers) based on std::vector of packed words.
+ *
+ * each value occupies Bits bits (1, 2, 4 or 8) and
+ * keys are implicit, same as MimicMap.
+ * if Rigid is false, out-of-range writes grow the container like MimicMap.
+ * if Rigid is true, out-of-range writes throw like RigidMap.
+ */
+template<typename K, typename V = bool, unsigned Bits = 1, bool Rigid = false>
+class PackedMap {
+  static_assert(Bits == 1 || Bits == 2 || Bits == 4 || Bits == 8,
+                "Bits must be 1, 2, 4 or 8");
+
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using word_type = uint64_t;
+  /**
+   * proxy to a packed value.
+   */
+  class reference {
+   public:
+    operator V() const {
+      return static_cast<V>((*word >> shift) & kMask);
+    }
+    reference& operator=(const V& value) {
+      const word_type raw = encode(value);
+      *word = (*word & ~(kMask << shift)) | (raw << shift);
+      return *this;
+    }
+    reference& operator=(const reference& other) {
+      return *this = static_cast<V>(other);
+    }
+
+   private:
+    friend class PackedMap;
+    reference(word_type* w, unsigned s) : word(w), shift(s) {}
+    word_type* word;
+    unsigned shift;
+  };
+
+ private:
+  template<bool Const>
+  class basic_iterator {
+    using map_type = typename std::conditional<
+      Const, const PackedMap, PackedMap>::type;
+
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = PackedMap::value_type;
+    using reference = typename std::conditional<
+      Const, value_type, std::pair<K, PackedMap::reference> >::type;
+    using pointer = void;
+    basic_iterator() : map(nullptr), offset(0) {}
+    basic_iterator(const basic_iterator<false>& other)  // NOLINT
+      : map(other.map), offset(other.offset) {}
+    /**
+     * returns the key of the element.
+     */
+    K key() const {
+      return static_cast<K>(map->minKey + offset);
+    }
+    reference operator*() const {
+      return reference(key(), map->slot(key()));
+    }
+    basic_iterator& operator++() {
+      ++offset;
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      basic_iterator tmp(*this);
+      ++offset;
+      return tmp;
+    }
+    basic_iterator& operator--() {
+      --offset;
+      return *this;
+    }
+    basic_iterator operator--(int) {
+      basic_iterator tmp(*this);
+      --offset;
+      return tmp;
+    }
+    bool operator==(const basic_iterator& other) const {
+      return offset == other.offset;
+    }
+    bool operator!=(const basic_iterator& other) const {
+      return offset != other.offset;
+    }
+
+   private:
+    friend class PackedMap;
+    template<bool> friend class basic_iterator;
+    basic_iterator(map_type* m, size_t i) : map(m), offset(i) {}
+    map_type* map;
+    size_t offset;
+  };
+
+ public:
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  /**
+   * constructs an empty container.
+   */
+  PackedMap()
+    : origin(), minKey(), count_(0),
+      hasLowerLimit(false), hasHigherLimit(false),
+      lowerLimit(), higherLimit() {}
+  /**
+   * swaps the contents.
+   */
+  void swap(PackedMap& other) {
+    std::swap(words, other.words);
+    std::swap(origin, other.origin);
+    std::swap(minKey, other.minKey);
+    std::swap(count_, other.count_);
+    std::swap(hasLowerLimit, other.hasLowerLimit);
+    std::swap(hasHigherLimit, other.hasHigherLimit);
+    std::swap(lowerLimit, other.lowerLimit);
+    std::swap(higherLimit, other.higherLimit);
+  }
+  /**
+   * returns the number of elements.
+   * same as the number from minimum key to maximum key.
+   */
+  size_t size() const {
+    return count_;
+  }
+  /**
+   * allocate elements.
+   */
+  void reserve(const K& low,
+               const K& high) {
+    if (empty()) {
+      assign(low, high);
+      return;
+    }
+    if (minKey > low) {
+      dig(low);
+    }
+    if (maxKey() < high) {
+      pile(high);
+    }
+  }
+  /**
+   * set lower limit of keys.
+   * MimicMap semantics: removes lower key entries if exists.
+   * RigidMap semantics: the range starts from given key.
+   */
+  PackedMap& setLowerLimit(const K& key) {
+    if (Rigid) {
+      if (empty() || maxKey() < key) {
+        clear();
+        assign(key, key);
+        return *this;
+      }
+    } else {
+      lowerLimit = key;
+      hasLowerLimit = true;
+      if (empty()) {
+        return *this;
+      }
+      if (maxKey() < key) {
+        clear();
+        return *this;
+      }
+    }
+    if (minKey < key) {
+      trimLower(key);
+    } else if (Rigid && minKey > key) {
+      dig(key);
+    }
+    return *this;
+  }
+  /**
+   * set higher limit of keys.
+   * MimicMap semantics: removes higher key entries if exists.
+   * RigidMap semantics: the range ends at given key.
+   */
+  PackedMap& setHigherLimit(const K& key) {
+    if (Rigid) {
+      if (empty() || minKey > key) {
+        clear();
+        assign(key, key);
+        return *this;
+      }
+    } else {
+      higherLimit = key;
+      hasHigherLimit = true;
+      if (empty()) {
+        return *this;
+      }
+      if (minKey > key) {
+        clear();
+        return *this;
+      }
+    }
+    if (maxKey() > key) {
+      trimHigher(key);
+    } else if (Rigid && maxKey() < key) {
+      pile(key);
+    }
+    return *this;
+  }
+  /**
+   * clears the contents.
+   */
+  void clear() {
+    words.clear();
+    count_ = 0;
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  iterator begin() {
+    return iterator(this, 0);
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  const_iterator begin() const {
+    return cbegin();
+  }
+  /**
+   * returns an iterator to the beginning.
+   */
+  const_iterator cbegin() const {
+    return const_iterator(this, 0);
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  iterator end() {
+    return iterator(this, count_);
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  const_iterator end() const {
+    return cend();
+  }
+  /**
+   * returns an iterator to the end.
+   */
+  const_iterator cend() const {
+    return const_iterator(this, count_);
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  reverse_iterator rbegin() {
+    return reverse_iterator(end());
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  const_reverse_iterator rbegin() const {
+    return crbegin();
+  }
+  /**
+   * returns a reverse iterator to the beginning.
+   */
+  const_reverse_iterator crbegin() const {
+    return const_reverse_iterator(cend());
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  reverse_iterator rend() {
+    return reverse_iterator(begin());
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  const_reverse_iterator rend() const {
+    return crend();
+  }
+  /**
+   * returns a reverse iterator to the end.
+   */
+  const_reverse_iterator crend() const {
+    return const_reverse_iterator(cbegin());
+  }
+  /**
+   * checks whether the container is empty.
+   */
+  bool empty() const {
+    return count_ == 0;
+  }
+  /**
+   * returns the number of elements matching specific key.
+   */
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  /**
+   * checks if the container contains element with specific key.
+   */
+  template <typename Key>
+  bool contains(const Key& key) const {
+    if (empty()) {
+      return false;
+    }
+    return !(key < minKey) && !(key > maxKey());
+  }
+  /**
+   * inserts element.
+   *
+   * returns a pair consisting of an iterator to the element
+   * (inserted or updated) and a bool denoting
+   * whether inserted or not.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits
+   *   or value exceeds Bits.
+   */
+  std::pair<iterator, bool> insert(const value_type& value) {
+    const K key = value.first;
+    const word_type raw = encode(value.second);
+    bool inserted = false;
+    if (!contains(key)) {
+      grow(key);
+      inserted = true;
+    }
+    reference ref = slot(key);
+    *ref.word = (*ref.word & ~(kMask << ref.shift)) | (raw << ref.shift);
+    return std::make_pair(iterator(this, key - minKey), inserted);
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  iterator find(const Key& key) {
+    if (!contains(key)) {
+      return end();
+    }
+    return iterator(this, key - minKey);
+  }
+  /**
+   * finds element with specific key.
+   */
+  template <typename Key>
+  const_iterator find(const Key& key) const {
+    if (!contains(key)) {
+      return end();
+    }
+    return const_iterator(this, key - minKey);
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  reference at(const Key& key) {
+    if (!contains(key)) {
+      throw std::out_of_range("key not found");
+    }
+    return slot(key);
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  V at(const Key& key) const {
+    if (!contains(key)) {
+      throw std::out_of_range("key not found");
+    }
+    return slot(key);
+  }
+  /**
+   * access or insert specified element.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   */
+  template <typename Key>
+  reference operator[](const Key& key) {
+    if (!contains(key)) {
+      grow(key);
+    }
+    return slot(key);
+  }
+  /**
+   * returns the number of elements holding specific value.
+   * counts a word (64 / Bits elements) at a time.
+   */
+  size_t countValue(const V& value) const {
+    if (empty()) {
+      return 0;
+    }
+    const word_type pattern = broadcast(encode(value));
+    const size_t first = index(minKey);
+    const size_t last = first + count_;
+    size_t n = 0;
+    for (size_t w = first / kPerWord; w * kPerWord < last; ++w) {
+      n += popcount(matches(w, pattern, first, last));
+    }
+    return n;
+  }
+  /**
+   * finds the first element holding specific value
+   * whose key is not less than given key.
+   * scans a word (64 / Bits elements) at a time.
+   */
+  template <typename Key>
+  const_iterator findValue(const V& value, const Key& from) const {
+    if (empty() || from > maxKey()) {
+      return end();
+    }
+    const word_type pattern = broadcast(encode(value));
+    const size_t first = index(from < minKey ? minKey : static_cast<K>(from));
+    const size_t last = index(minKey) + count_;
+    for (size_t w = first / kPerWord; w * kPerWord < last; ++w) {
+      const word_type m = matches(w, pattern, first, last);
+      if (m != 0) {
+        const size_t i = w * kPerWord + ctz(m) / Bits;
+        return const_iterator(this, i - index(minKey));
+      }
+    }
+    return end();
+  }
+  /**
+   * finds the first element holding specific value.
+   */
+  const_iterator findValue(const V& value) const {
+    return findValue(value, minKey);
+  }
+
+ private:
+  static constexpr unsigned kPerWord = 64 / Bits;
+  static constexpr word_type kMask = (word_type(1) << Bits) - 1;
+  /**
+   * the lowest bit of each field.
+   */
+  static constexpr word_type kLowBits = ~word_type(0) / kMask;
+  /**
+   * packed values. field 0 of words[0] holds the key origin.
+   * fields out of [minKey, maxKey] are kept zero.
+   */
+  std::vector<word_type> words;
+  K origin;
+  K minKey;
+  size_t count_;
+  bool hasLowerLimit;
+  bool hasHigherLimit;
+  K lowerLimit;
+  K higherLimit;
+
+  K maxKey() const {
+    return static_cast<K>(minKey + (count_ - 1));
+  }
+  size_t index(const K& key) const {
+    return static_cast<size_t>(key - origin);
+  }
+  reference slot(const K& key) const {
+    const size_t i = index(key);
+    return reference(const_cast<word_type*>(&words[i / kPerWord]),
+                     static_cast<unsigned>(i % kPerWord) * Bits);
+  }
+  static word_type encode(const V& value) {
+    const word_type raw = static_cast<word_type>(value);
+    if (raw > kMask) {
+      throw std::out_of_range("value exceeds bit width");
+    }
+    return raw;
+  }
+  static word_type broadcast(word_type raw) {
+    return raw * kLowBits;
+  }
+  static unsigned popcount(word_type w) {
+    return static_cast<unsigned>(__builtin_popcountll(w));
+  }
+  static unsigned ctz(word_type w) {
+    return static_cast<unsigned>(__builtin_ctzll(w));
+  }
+  /**
+   * returns the lowest bits of fields in words[w] equal to pattern,
+   * restricted to field indexes [first, last).
+   */
+  word_type matches(size_t w, word_type pattern,
+                    size_t first, size_t last) const {
+    word_type x = words[w] ^ pattern;
+    if (Bits >= 2) {
+      x |= x >> 1;
+    }
+    if (Bits >= 4) {
+      x |= x >> 2;
+    }
+    if (Bits >= 8) {
+      x |= x >> 4;
+    }
+    word_type m = ~x & kLowBits;
+    const size_t base = w * kPerWord;
+    if (first > base) {
+      m &= ~word_type(0) << ((first - base) * Bits);
+    }
+    if (last < base + kPerWord) {
+      m &= ~(~word_type(0) << ((last - base) * Bits));
+    }
+    return m;
+  }
+  /**
+   * clears fields of indexes [first, last) a word at a time.
+   */
+  void zero(size_t first, size_t last) {
+    while (first < last) {
+      const size_t w = first / kPerWord;
+      const size_t begin = first % kPerWord;
+      const size_t end = std::min<size_t>(kPerWord, begin + (last - first));
+      word_type m = ~word_type(0) << (begin * Bits);
+      if (end < kPerWord) {
+        m &= ~(~word_type(0) << (end * Bits));
+      }
+      words[w] &= ~m;
+      first += end - begin;
+    }
+  }
+  /**
+   * allocate elements of empty container.
+   */
+  void assign(const K& low, const K& high) {
+    assert(empty());
+    if (high < low) {
+      return;
+    }
+    origin = low;
+    minKey = low;
+    count_ = static_cast<size_t>(high - low) + 1;
+    words.assign((count_ + kPerWord - 1) / kPerWord, 0);
+  }
+  /**
+   * expand the region of elements to contain given key.
+   */
+  void grow(const K& key) {
+    if (Rigid) {
+      if (empty()) {
+        throw std::out_of_range("empty map");
+      }
+      if (key < minKey) {
+        throw std::out_of_range("lower limit exceeded");
+      }
+      throw std::out_of_range("higher limit exceeded");
+    }
+    if (empty()) {
+      if (hasLowerLimit && key < lowerLimit) {
+        throw std::out_of_range("lower limit exceeded");
+      }
+      if (hasHigherLimit && key > higherLimit) {
+        throw std::out_of_range("higher limit exceeded");
+      }
+      assign(key, key);
+    } else if (key < minKey) {
+      dig(key);
+    } else {
+      pile(key);
+    }
+  }
+  /**
+   * expand the region of elements forward given key.
+   */
+  void dig(const K& key) {
+    if (!Rigid && hasLowerLimit && key < lowerLimit) {
+      throw std::out_of_range("lower limit exceeded");
+    }
+    if (key < origin) {
+      const size_t need = static_cast<size_t>(origin - key);
+      const size_t n = (need + kPerWord - 1) / kPerWord;
+      words.insert(words.begin(), n, 0);
+      origin = static_cast<K>(origin - n * kPerWord);
+    }
+    count_ += static_cast<size_t>(minKey - key);
+    minKey = key;
+  }
+  /**
+   * expand the region of elements toward given key.
+   */
+  void pile(const K& key) {
+    if (!Rigid && hasHigherLimit && key > higherLimit) {
+      throw std::out_of_range("higher limit exceeded");
+    }
+    const size_t n = index(key) / kPerWord + 1;
+    if (words.size() < n) {
+      words.resize(n, 0);
+    }
+    count_ = static_cast<size_t>(key - minKey) + 1;
+  }
+  /**
+   * removes entries lower than given key.
+   */
+  void trimLower(const K& key) {
+    const size_t i = index(key);
+    zero(index(minKey), i);
+    const size_t n = i / kPerWord;
+    words.erase(words.begin(), words.begin() + n);
+    origin = static_cast<K>(origin + n * kPerWord);
+    count_ -= static_cast<size_t>(key - minKey);
+    minKey = key;
+  }
+  /**
+   * removes entries higher than given key.
+   */
+  void trimHigher(const K& key) {
+    const size_t i = index(key) + 1;
+    zero(i, index(minKey) + count_);
+    words.resize((i + kPerWord - 1) / kPerWord);
+    count_ = static_cast<size_t>(key - minKey) + 1;
+  }
+};
+/**
+ * MimicMap of presence flags, one bit per key.
+ */
+template<typename K>
+using BitMap = PackedMap<K, bool, 1, false>;
+/**
+ * RigidMap of presence flags, one bit per key.
+ */
+template<typename K>
+using RigidBitMap = PackedMap<K, bool, 1, true>;
+#endif  // PACKEDMAP_H_
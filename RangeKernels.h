@@ -0,0 +1,609 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef RANGEKERNELS_H_
+#define RANGEKERNELS_H_
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * predicates of countIfRange and findFirstIfRange
+ * which can be evaluated by SIMD kernels.
+ * any other predicate is evaluated element by element.
+ */
+enum class RangeCompare { kGreater, kLess, kEqual, kNotEqual };
+template<typename V>
+struct GreaterThan {
+  static constexpr RangeCompare kCompare = RangeCompare::kGreater;
+  V value;
+  explicit GreaterThan(const V& x) : value(x) {}
+  bool operator()(const V& x) const {
+    return x > value;
+  }
+};
+template<typename V>
+struct LessThan {
+  static constexpr RangeCompare kCompare = RangeCompare::kLess;
+  V value;
+  explicit LessThan(const V& x) : value(x) {}
+  bool operator()(const V& x) const {
+    return x < value;
+  }
+};
+template<typename V>
+struct EqualTo {
+  static constexpr RangeCompare kCompare = RangeCompare::kEqual;
+  V value;
+  explicit EqualTo(const V& x) : value(x) {}
+  bool operator()(const V& x) const {
+    return x == value;
+  }
+};
+template<typename V>
+struct NotEqualTo {
+  static constexpr RangeCompare kCompare = RangeCompare::kNotEqual;
+  V value;
+  explicit NotEqualTo(const V& x) : value(x) {}
+  bool operator()(const V& x) const {
+    return x != value;
+  }
+};
+
+namespace range_kernels {
+/**
+ * type of sums: 64 bit for integers, double for float.
+ */
+template<typename V>
+using sum_type = typename std::conditional<
+  std::is_integral<V>::value,
+  typename std::conditional<std::is_signed<V>::value, int64_t, uint64_t>::type,
+  typename std::conditional<std::is_same<V, float>::value, double, V>::type
+  >::type;
+
+/**
+ * checks whether Pred is one of predicates above for V.
+ */
+template<typename Pred, typename V>
+struct is_simd_predicate : std::false_type {};
+template<typename V>
+struct is_simd_predicate<GreaterThan<V>, V> : std::true_type {};
+template<typename V>
+struct is_simd_predicate<LessThan<V>, V> : std::true_type {};
+template<typename V>
+struct is_simd_predicate<EqualTo<V>, V> : std::true_type {};
+template<typename V>
+struct is_simd_predicate<NotEqualTo<V>, V> : std::true_type {};
+
+/**
+ * where values are in storage of std::pair<K, V> seen as array of V:
+ * the value of i-th element is at i * kStride + kOffset.
+ */
+template<typename K, typename V,
+         bool = (std::is_arithmetic<V>::value &&
+                 !std::is_same<V, bool>::value &&
+                 (sizeof(V) == 4 || sizeof(V) == 8) &&
+                 (std::is_arithmetic<K>::value || std::is_enum<K>::value))>
+struct Layout {
+  static constexpr bool kSimd = false;
+  static constexpr size_t kStride = 0;
+  static constexpr size_t kOffset = 0;
+};
+template<typename K, typename V>
+struct Layout<K, V, true> {
+  using pair = std::pair<K, V>;
+  static constexpr size_t kStride = sizeof(pair) / sizeof(V);
+  static constexpr size_t kOffset = offsetof(pair, second) / sizeof(V);
+  // the smallest vector must hold whole elements.
+  static constexpr bool kSimd =
+    sizeof(pair) % sizeof(V) == 0 &&
+    offsetof(pair, second) % sizeof(V) == 0 &&
+    (16 / sizeof(V)) % kStride == 0;
+};
+
+/**
+ * checks whether elements of Map are contiguous in memory.
+ */
+template<typename Map>
+struct is_contiguous : std::integral_constant<
+  bool,
+  std::is_same<typename Map::const_iterator,
+               const typename Map::value_type*>::value ||
+  std::is_same<typename Map::const_iterator,
+               typename std::vector<
+                 typename Map::value_type,
+                 typename Map::allocator_type>::const_iterator>::value> {};
+
+enum Isa { kDefault, kAvx2, kAvx512 };
+/**
+ * detects the best instruction set once.
+ */
+inline Isa isa() {
+#if defined(__x86_64__) || defined(__i386__)
+  static const Isa detected = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl")) {
+      return kAvx512;
+    }
+    return __builtin_cpu_supports("avx2") ? kAvx2 : kDefault;
+  }();
+  return detected;
+#else
+  return kDefault;
+#endif
+}
+
+/**
+ * kernels over n elements of storage p with given vector size.
+ * each vector holds Bytes / sizeof(V) lanes of keys and values,
+ * and a lane holds values only if (lane % Stride) == Offset.
+ * they are always inlined into target specific functions below.
+ */
+template<typename V, size_t Bytes>
+struct simd {
+  typedef V type __attribute__((vector_size(Bytes)));
+};
+template<typename V>
+inline __attribute__((always_inline))
+V loadValue(const unsigned char* p, size_t i, size_t stride, size_t offset) {
+  V v;
+  std::memcpy(&v, p + (i * stride + offset) * sizeof(V), sizeof(V));
+  return v;
+}
+/**
+ * vectors are passed by pointer, since passing them by value
+ * changes the ABI depending on the target.
+ */
+template<RangeCompare C, typename X, typename V, typename R>
+inline __attribute__((always_inline))
+void compare(const X& x, const V& v, R* result) {
+  if constexpr (C == RangeCompare::kGreater) {
+    *result = x > v;
+  } else if constexpr (C == RangeCompare::kLess) {
+    *result = x < v;
+  } else if constexpr (C == RangeCompare::kEqual) {
+    *result = x == v;
+  } else {
+    *result = x != v;
+  }
+}
+template<typename V, size_t Bytes, size_t Stride, size_t Offset, bool Max>
+inline __attribute__((always_inline))
+V extremumKernel(const unsigned char* p, size_t n) {
+  constexpr size_t kLanes = Bytes / sizeof(V);
+  using vec = typename simd<V, Bytes>::type;
+  const V first = loadValue<V>(p, 0, Stride, Offset);
+  vec acc = vec{} + first;
+  size_t i = 0;
+  for (; i + kLanes <= n * Stride; i += kLanes) {
+    vec x;
+    std::memcpy(&x, p + i * sizeof(V), Bytes);
+    // keeps acc if x is NaN, as the sequential loop does.
+    acc = Max ? (acc < x ? x : acc) : (x < acc ? x : acc);
+  }
+  V result = first;
+  for (size_t lane = Offset; lane < kLanes; lane += Stride) {
+    if (Max ? result < acc[lane] : acc[lane] < result) {
+      result = acc[lane];
+    }
+  }
+  for (size_t e = i / Stride; e < n; ++e) {
+    const V v = loadValue<V>(p, e, Stride, Offset);
+    if (Max ? result < v : v < result) {
+      result = v;
+    }
+  }
+  return result;
+}
+template<typename V, typename S, size_t Bytes, size_t Stride, size_t Offset>
+inline __attribute__((always_inline))
+S sumKernel(const unsigned char* p, size_t n) {
+  constexpr size_t kLanes = Bytes / sizeof(V);
+  using vec = typename simd<V, Bytes>::type;
+  using wide = typename simd<S, kLanes * sizeof(S)>::type;
+  // integers are added without sign, since lanes of keys may overflow.
+  using U = typename std::conditional<
+    std::is_integral<S>::value, std::make_unsigned<S>,
+    std::common_type<S> >::type::type;
+  using unsigned_wide = typename simd<U, kLanes * sizeof(S)>::type;
+  unsigned_wide acc = {};
+  size_t i = 0;
+  for (; i + kLanes <= n * Stride; i += kLanes) {
+    vec x;
+    std::memcpy(&x, p + i * sizeof(V), Bytes);
+    acc += (unsigned_wide)__builtin_convertvector(x, wide);
+  }
+  U total = U();
+  for (size_t lane = Offset; lane < kLanes; lane += Stride) {
+    total += acc[lane];
+  }
+  S result = static_cast<S>(total);
+  for (size_t e = i / Stride; e < n; ++e) {
+    result += loadValue<V>(p, e, Stride, Offset);
+  }
+  return result;
+}
+template<typename V, size_t Bytes, size_t Stride, size_t Offset,
+         RangeCompare C>
+inline __attribute__((always_inline))
+size_t countKernel(const unsigned char* p, size_t n, const V& value) {
+  constexpr size_t kLanes = Bytes / sizeof(V);
+  // flushes lane counters before they overflow.
+  constexpr size_t kFlush = size_t(1) << 24;
+  using vec = typename simd<V, Bytes>::type;
+  using mask = decltype(vec{} < vec{});
+  size_t result = 0;
+  size_t i = 0;
+  while (i + kLanes <= n * Stride) {
+    const size_t last = std::min(n * Stride / kLanes * kLanes,
+                                 i + kFlush * kLanes);
+    mask acc = {};
+    for (; i < last; i += kLanes) {
+      vec x;
+      std::memcpy(&x, p + i * sizeof(V), Bytes);
+      mask m;
+      compare<C>(x, value, &m);
+      // true is -1.
+      acc -= m;
+    }
+    for (size_t lane = Offset; lane < kLanes; lane += Stride) {
+      result += static_cast<size_t>(acc[lane]);
+    }
+  }
+  for (size_t e = i / Stride; e < n; ++e) {
+    bool hit;
+    compare<C>(loadValue<V>(p, e, Stride, Offset), value, &hit);
+    result += hit ? 1 : 0;
+  }
+  return result;
+}
+template<typename V, size_t Bytes, size_t Stride, size_t Offset,
+         RangeCompare C>
+inline __attribute__((always_inline))
+size_t findKernel(const unsigned char* p, size_t n, const V& value) {
+  // counts blocks of elements, then looks into the block found.
+  constexpr size_t kBlock = 256;
+  for (size_t e = 0; e < n; e += kBlock) {
+    const size_t m = std::min(kBlock, n - e);
+    const unsigned char* block = p + e * Stride * sizeof(V);
+    if (countKernel<V, Bytes, Stride, Offset, C>(block, m, value) == 0) {
+      continue;
+    }
+    for (size_t i = 0; i < m; ++i) {
+      bool hit;
+      compare<C>(loadValue<V>(block, i, Stride, Offset), value, &hit);
+      if (hit) {
+        return e + i;
+      }
+    }
+  }
+  return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RANGEKERNELS_AVX2 __attribute__((target("avx2")))
+#define RANGEKERNELS_AVX512 \
+  __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl")))
+template<typename V, size_t Stride, size_t Offset, bool Max>
+RANGEKERNELS_AVX2 V extremumAvx2(const unsigned char* p, size_t n) {
+  return extremumKernel<V, 32, Stride, Offset, Max>(p, n);
+}
+template<typename V, size_t Stride, size_t Offset, bool Max>
+RANGEKERNELS_AVX512 V extremumAvx512(const unsigned char* p, size_t n) {
+  return extremumKernel<V, 64, Stride, Offset, Max>(p, n);
+}
+template<typename V, typename S, size_t Stride, size_t Offset>
+RANGEKERNELS_AVX2 S sumAvx2(const unsigned char* p, size_t n) {
+  return sumKernel<V, S, 32, Stride, Offset>(p, n);
+}
+template<typename V, typename S, size_t Stride, size_t Offset>
+RANGEKERNELS_AVX512 S sumAvx512(const unsigned char* p, size_t n) {
+  return sumKernel<V, S, 64, Stride, Offset>(p, n);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+RANGEKERNELS_AVX2
+size_t countAvx2(const unsigned char* p, size_t n, const V& value) {
+  return countKernel<V, 32, Stride, Offset, C>(p, n, value);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+RANGEKERNELS_AVX512
+size_t countAvx512(const unsigned char* p, size_t n, const V& value) {
+  return countKernel<V, 64, Stride, Offset, C>(p, n, value);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+RANGEKERNELS_AVX2
+size_t findAvx2(const unsigned char* p, size_t n, const V& value) {
+  return findKernel<V, 32, Stride, Offset, C>(p, n, value);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+RANGEKERNELS_AVX512
+size_t findAvx512(const unsigned char* p, size_t n, const V& value) {
+  return findKernel<V, 64, Stride, Offset, C>(p, n, value);
+}
+#undef RANGEKERNELS_AVX2
+#undef RANGEKERNELS_AVX512
+#endif
+
+/**
+ * dispatchers selecting kernels by instruction set.
+ * a vector must hold whole elements, so that lanes of values
+ * are the same in every vector.
+ * 16 bytes vectors are supported by every target.
+ */
+template<typename V, size_t Stride, size_t Offset, bool Max>
+V extremum(const unsigned char* p, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+  if constexpr ((64 / sizeof(V)) % Stride == 0) {
+    if (isa() == kAvx512) {
+      return extremumAvx512<V, Stride, Offset, Max>(p, n);
+    }
+  }
+  if constexpr ((32 / sizeof(V)) % Stride == 0) {
+    if (isa() >= kAvx2) {
+      return extremumAvx2<V, Stride, Offset, Max>(p, n);
+    }
+  }
+#endif
+  return extremumKernel<V, 16, Stride, Offset, Max>(p, n);
+}
+template<typename V, typename S, size_t Stride, size_t Offset>
+S sum(const unsigned char* p, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+  if constexpr ((64 / sizeof(V)) % Stride == 0) {
+    if (isa() == kAvx512) {
+      return sumAvx512<V, S, Stride, Offset>(p, n);
+    }
+  }
+  if constexpr ((32 / sizeof(V)) % Stride == 0) {
+    if (isa() >= kAvx2) {
+      return sumAvx2<V, S, Stride, Offset>(p, n);
+    }
+  }
+#endif
+  return sumKernel<V, S, 16, Stride, Offset>(p, n);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+size_t count(const unsigned char* p, size_t n, const V& value) {
+#if defined(__x86_64__) || defined(__i386__)
+  if constexpr ((64 / sizeof(V)) % Stride == 0) {
+    if (isa() == kAvx512) {
+      return countAvx512<V, Stride, Offset, C>(p, n, value);
+    }
+  }
+  if constexpr ((32 / sizeof(V)) % Stride == 0) {
+    if (isa() >= kAvx2) {
+      return countAvx2<V, Stride, Offset, C>(p, n, value);
+    }
+  }
+#endif
+  return countKernel<V, 16, Stride, Offset, C>(p, n, value);
+}
+template<typename V, size_t Stride, size_t Offset, RangeCompare C>
+size_t find(const unsigned char* p, size_t n, const V& value) {
+#if defined(__x86_64__) || defined(__i386__)
+  if constexpr ((64 / sizeof(V)) % Stride == 0) {
+    if (isa() == kAvx512) {
+      return findAvx512<V, Stride, Offset, C>(p, n, value);
+    }
+  }
+  if constexpr ((32 / sizeof(V)) % Stride == 0) {
+    if (isa() >= kAvx2) {
+      return findAvx2<V, Stride, Offset, C>(p, n, value);
+    }
+  }
+#endif
+  return findKernel<V, 16, Stride, Offset, C>(p, n, value);
+}
+
+/**
+ * elements of keys in [low, high] which exist in the map.
+ */
+template<typename Map>
+struct Span {
+  using K = typename Map::key_type;
+  using V = typename Map::mapped_type;
+  using layout = Layout<K, V>;
+  static constexpr bool kSimd = layout::kSimd && is_contiguous<Map>::value;
+  typename Map::const_iterator first;
+  size_t n;
+  Span(const Map& m, const K& low, const K& high) : first(m.end()), n(0) {
+    if (m.empty() || high < low) {
+      return;
+    }
+    const K lo = std::max(low, m.begin()->first);
+    const K hi = std::min(high, m.rbegin()->first);
+    if (hi < lo) {
+      return;
+    }
+    first = m.find(lo);
+    n = static_cast<size_t>(std::distance(first, m.find(hi))) + 1;
+  }
+  /**
+   * must not be called if n is 0.
+   */
+  const unsigned char* data() const {
+    return reinterpret_cast<const unsigned char*>(std::addressof(*first));
+  }
+  template<bool Max>
+  V extremum() const {
+    if constexpr (kSimd) {
+      return range_kernels::extremum<
+        V, layout::kStride, layout::kOffset, Max>(data(), n);
+    } else {
+      typename Map::const_iterator iter = first;
+      V result = iter->second;
+      for (size_t i = 1; i < n; ++i) {
+        ++iter;
+        if (Max ? result < iter->second : iter->second < result) {
+          result = iter->second;
+        }
+      }
+      return result;
+    }
+  }
+  sum_type<V> sum() const {
+    if constexpr (kSimd) {
+      if (n == 0) {
+        return sum_type<V>();
+      }
+      return range_kernels::sum<
+        V, sum_type<V>, layout::kStride, layout::kOffset>(data(), n);
+    } else {
+      sum_type<V> result = sum_type<V>();
+      typename Map::const_iterator iter = first;
+      for (size_t i = 0; i < n; ++i, ++iter) {
+        result += iter->second;
+      }
+      return result;
+    }
+  }
+  template<typename Pred>
+  size_t countIf(Pred pred) const {
+    if constexpr (kSimd && is_simd_predicate<Pred, V>::value) {
+      if (n == 0) {
+        return 0;
+      }
+      return range_kernels::count<
+        V, layout::kStride, layout::kOffset, Pred::kCompare>(
+          data(), n, pred.value);
+    } else {
+      size_t result = 0;
+      typename Map::const_iterator iter = first;
+      for (size_t i = 0; i < n; ++i, ++iter) {
+        if (pred(iter->second)) {
+          ++result;
+        }
+      }
+      return result;
+    }
+  }
+  /**
+   * returns the index of the first element satisfying pred, or n.
+   */
+  template<typename Pred>
+  size_t findIf(Pred pred) const {
+    if constexpr (kSimd && is_simd_predicate<Pred, V>::value) {
+      if (n == 0) {
+        return 0;
+      }
+      return range_kernels::find<
+        V, layout::kStride, layout::kOffset, Pred::kCompare>(
+          data(), n, pred.value);
+    } else {
+      typename Map::const_iterator iter = first;
+      for (size_t i = 0; i < n; ++i, ++iter) {
+        if (pred(iter->second)) {
+          return i;
+        }
+      }
+      return n;
+    }
+  }
+};
+}  // namespace range_kernels
+
+/**
+ * returns the minimum value of keys in [low, high].
+ * keys out of the map are ignored.
+ *
+ * exceptions:
+ *   std::out_of_range if no key in [low, high] exists.
+ */
+template<typename Map>
+typename Map::mapped_type minRange(const Map& m,
+                                   const typename Map::key_type& low,
+                                   const typename Map::key_type& high) {
+  const range_kernels::Span<Map> span(m, low, high);
+  if (span.n == 0) {
+    throw std::out_of_range("empty range");
+  }
+  return span.template extremum<false>();
+}
+/**
+ * returns the maximum value of keys in [low, high].
+ * keys out of the map are ignored.
+ *
+ * exceptions:
+ *   std::out_of_range if no key in [low, high] exists.
+ */
+template<typename Map>
+typename Map::mapped_type maxRange(const Map& m,
+                                   const typename Map::key_type& low,
+                                   const typename Map::key_type& high) {
+  const range_kernels::Span<Map> span(m, low, high);
+  if (span.n == 0) {
+    throw std::out_of_range("empty range");
+  }
+  return span.template extremum<true>();
+}
+/**
+ * returns the first key of the maximum value in [low, high].
+ * keys out of the map are ignored.
+ *
+ * exceptions:
+ *   std::out_of_range if no key in [low, high] exists.
+ */
+template<typename Map>
+typename Map::key_type argmaxRange(const Map& m,
+                                   const typename Map::key_type& low,
+                                   const typename Map::key_type& high) {
+  const range_kernels::Span<Map> span(m, low, high);
+  if (span.n == 0) {
+    throw std::out_of_range("empty range");
+  }
+  using V = typename Map::mapped_type;
+  const size_t i =
+    span.findIf(EqualTo<V>(span.template extremum<true>()));
+  // the maximum equals to no value only if the first value is NaN.
+  return std::next(span.first, i < span.n ? i : 0)->first;
+}
+/**
+ * returns the sum of values of keys in [low, high].
+ * integers are summed up in 64 bit, and float in double.
+ * keys out of the map are ignored.
+ */
+template<typename Map>
+range_kernels::sum_type<typename Map::mapped_type>
+sumRange(const Map& m,
+         const typename Map::key_type& low,
+         const typename Map::key_type& high) {
+  return range_kernels::Span<Map>(m, low, high).sum();
+}
+/**
+ * returns the number of values of keys in [low, high] satisfying pred.
+ * GreaterThan, LessThan, EqualTo and NotEqualTo run SIMD kernels.
+ * keys out of the map are ignored.
+ */
+template<typename Map, typename Pred>
+size_t countIfRange(const Map& m,
+                    const typename Map::key_type& low,
+                    const typename Map::key_type& high,
+                    Pred pred) {
+  return range_kernels::Span<Map>(m, low, high).countIf(pred);
+}
+/**
+ * returns an iterator to the first element of keys in [low, high]
+ * whose value satisfies pred, or end() if not found.
+ * GreaterThan, LessThan, EqualTo and NotEqualTo run SIMD kernels.
+ * keys out of the map are ignored.
+ */
+template<typename Map, typename Pred>
+typename Map::const_iterator findFirstIfRange(
+  const Map& m,
+  const typename Map::key_type& low,
+  const typename Map::key_type& high,
+  Pred pred) {
+  const range_kernels::Span<Map> span(m, low, high);
+  const size_t i = span.findIf(pred);
+  return i < span.n ? std::next(span.first, i) : m.end();
+}
+#endif  // RANGEKERNELS_H_
@@ -0,0 +1,44 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+#include <vector>
+
+/**
+ * helpers shared by binary formats of Checkpoint.h and MapStream.h.
+ * values are stored in native byte order.
+ */
+namespace serialize {
+/**
+ * appends the bytes of value.
+ */
+template<typename T>
+void put(std::vector<char>* out, const T& value) {
+  const char* p = reinterpret_cast<const char*>(&value);
+  out->insert(out->end(), p, p + sizeof(T));
+}
+/**
+ * writes n bytes from p, retrying short and interrupted writes.
+ *
+ * exceptions:
+ *   std::system_error if write fails.
+ */
+inline void writeAll(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    const ssize_t r = ::write(fd, p, n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r < 0) {
+      throw std::system_error(errno, std::generic_category(), "write");
+    }
+    p += r;
+    n -= static_cast<size_t>(r);
+  }
+}
+}  // namespace serialize
+#endif  // SERIALIZE_H_
@@ -0,0 +1,491 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef SHAREDMIMICMAP_H_
+#define SHAREDMIMICMAP_H_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/**
+ * shared memory segment format.
+ *
+ * a segment is a Header followed by capacity values at offset
+ * from the beginning. value i holds key (origin + i).
+ * the segment has no pointers, so that processes may map it
+ * at any address.
+ */
+namespace shared_map {
+static constexpr uint32_t kMagic = 0x4d534d4d;  // "MMSM"
+static constexpr uint32_t kVersion = 1;
+
+template<typename K>
+struct Header {
+  /**
+   * stored last by the writer, so that readers do not attach
+   * to a segment being initialized.
+   */
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t keySize;
+  uint32_t valueSize;
+  uint64_t offset;
+  uint64_t capacity;
+  K origin;
+  /**
+   * seqlock: odd while the writer changes the segment.
+   */
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> size;
+  std::atomic<K> minKey;
+  std::atomic<K> maxKey;
+};
+}  // namespace shared_map
+
+/**
+ * MimicMap placed in POSIX shared memory,
+ * written by one process and read by others.
+ *
+ * the writer creates a segment for keys in [low, high], and
+ * the region of elements grows within them as keys are written.
+ * pages of the segment are allocated when written,
+ * so that wide limits cost nothing until used.
+ * readers attach to the segment by name without copying elements.
+ * readers take no locks; a seqlock lets them retry reads overlapping
+ * with writes, so that they see each write as a whole.
+ * elements not written yet in the region read as zero bytes.
+ * readers wait for a write in progress, even if the writer is killed
+ * during it, until a new segment replaces it.
+ */
+template<typename K, typename V>
+class SharedMimicMap {
+  static_assert(std::is_integral<K>::value, "K must be integral");
+  static_assert(std::is_trivially_copyable<V>::value,
+                "V must be trivially copyable");
+  static_assert(std::atomic<K>::is_always_lock_free &&
+                std::atomic<uint64_t>::is_always_lock_free,
+                "atomics in shared memory must be lock free");
+  using U = typename std::make_unsigned<K>::type;
+  using Header = shared_map::Header<K>;
+
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  /**
+   * creates a segment for keys in [low, high] and attaches to it
+   * as the writer. an existing segment of the name is unlinked,
+   * while readers attached to it keep the old elements.
+   *
+   * exceptions:
+   *   std::length_error if [low, high] is too wide.
+   *   std::system_error if the segment cannot be created.
+   */
+  static SharedMimicMap create(const std::string& name,
+                               const K& low, const K& high) {
+    if (high < low) {
+      throw std::length_error("higher limit below lower limit");
+    }
+    const size_t span = distance(low, high);
+    const size_t offset = valuesOffset();
+    if (span >= (std::numeric_limits<size_t>::max() - offset) / sizeof(V)) {
+      throw std::length_error("too many elements");
+    }
+    const size_t capacity = span + 1;
+    const size_t bytes = offset + capacity * sizeof(V);
+    ::shm_unlink(name.c_str());
+    const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), name);
+    }
+    if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+      const int error = errno;
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      throw std::system_error(error, std::generic_category(), name);
+    }
+    SharedMimicMap m;
+    m.map(fd, bytes, true, name);
+    // begins the lifetime of the header and its atomics
+    // in the zero-filled segment.
+    Header* h = new (m.header) Header();
+    h->version = shared_map::kVersion;
+    h->keySize = sizeof(K);
+    h->valueSize = sizeof(V);
+    h->offset = offset;
+    h->capacity = capacity;
+    h->origin = low;
+    h->magic.store(shared_map::kMagic, std::memory_order_release);
+    return m;
+  }
+  /**
+   * attaches to a segment created by the writer as a reader.
+   *
+   * exceptions:
+   *   std::system_error if the segment cannot be opened.
+   *   std::runtime_error if the segment is not of this type
+   *   or not initialized yet.
+   */
+  static SharedMimicMap attach(const std::string& name) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), name);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), name);
+    }
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    if (bytes < valuesOffset()) {
+      ::close(fd);
+      throw std::runtime_error("segment not initialized");
+    }
+    SharedMimicMap m;
+    m.map(fd, bytes, false, name);
+    const Header* h = m.header;
+    if (h->magic.load(std::memory_order_acquire) != shared_map::kMagic) {
+      throw std::runtime_error("segment not initialized");
+    }
+    if (h->version != shared_map::kVersion || h->keySize != sizeof(K) ||
+        h->valueSize != sizeof(V) || h->offset != valuesOffset() ||
+        h->capacity > (bytes - h->offset) / sizeof(V)) {
+      throw std::runtime_error("segment of another type");
+    }
+    return m;
+  }
+  /**
+   * removes the name of a segment.
+   * the segment is released when all processes detach.
+   */
+  static void unlink(const std::string& name) {
+    ::shm_unlink(name.c_str());
+  }
+  /**
+   * constructs an object attached to nothing.
+   */
+  SharedMimicMap() : header(nullptr), values(nullptr), bytes(0),
+                     writable(false) {}
+  SharedMimicMap(const SharedMimicMap&) = delete;
+  SharedMimicMap& operator=(const SharedMimicMap&) = delete;
+  /**
+   * move constructor.
+   */
+  SharedMimicMap(SharedMimicMap&& orig) noexcept : SharedMimicMap() {
+    swap(orig);
+  }
+  /**
+   * move assign operator.
+   */
+  SharedMimicMap& operator=(SharedMimicMap&& orig) noexcept {
+    SharedMimicMap(std::move(orig)).swap(*this);
+    return *this;
+  }
+  ~SharedMimicMap() {
+    detach();
+  }
+  void swap(SharedMimicMap& other) noexcept {
+    std::swap(header, other.header);
+    std::swap(values, other.values);
+    std::swap(bytes, other.bytes);
+    std::swap(writable, other.writable);
+    std::swap(segment, other.segment);
+  }
+  /**
+   * unmaps the segment. the segment keeps elements for others.
+   */
+  void detach() {
+    if (header != nullptr) {
+      ::munmap(header, bytes);
+    }
+    header = nullptr;
+    values = nullptr;
+    bytes = 0;
+    writable = false;
+    segment.clear();
+  }
+  bool attached() const {
+    return header != nullptr;
+  }
+  /**
+   * returns the name of the segment.
+   */
+  const std::string& name() const {
+    return segment;
+  }
+  /**
+   * returns the number of writes, which changes
+   * whenever the writer changes elements or the region.
+   */
+  uint64_t version() const {
+    return header->sequence.load(std::memory_order_acquire) / 2;
+  }
+  size_t size() const {
+    return read([this]() {
+      return static_cast<size_t>(
+        header->size.load(std::memory_order_relaxed));
+    });
+  }
+  bool empty() const {
+    return size() == 0;
+  }
+  /**
+   * returns the region of elements as [first, second].
+   *
+   * exceptions:
+   *   std::out_of_range if empty.
+   */
+  std::pair<K, K> range() const {
+    const std::pair<bool, std::pair<K, K> > r = read([this]() {
+      return std::make_pair(
+        header->size.load(std::memory_order_relaxed) != 0,
+        std::make_pair(header->minKey.load(std::memory_order_relaxed),
+                       header->maxKey.load(std::memory_order_relaxed)));
+    });
+    if (!r.first) {
+      throw std::out_of_range("empty");
+    }
+    return r.second;
+  }
+  template <typename Key>
+  bool contains(const Key& key) const {
+    return read([this, &key]() { return inRegion(key); });
+  }
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  /**
+   * copies the value of key to *value if key is in the region.
+   * returns true if copied.
+   */
+  template <typename Key>
+  bool lookup(const Key& key, V* value) const {
+    return read([this, &key, value]() {
+      if (!inRegion(key)) {
+        return false;
+      }
+      std::memcpy(static_cast<void*>(value), slot(static_cast<K>(key)),
+                  sizeof(V));
+      return true;
+    });
+  }
+  /**
+   * returns a copy of the value of key with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  V at(const Key& key) const {
+    V value;
+    if (!lookup(key, &value)) {
+      throw std::out_of_range("key not found");
+    }
+    return value;
+  }
+  /**
+   * writes value of key, expanding the region to contain key.
+   * only for the writer.
+   *
+   * exceptions:
+   *   std::out_of_range if key exceeds limits.
+   *   std::logic_error if attached as a reader.
+   */
+  void insert_or_assign(const K& key, const V& value) {
+    check(key, key);
+    Write w(header);
+    expand(key, key);
+    std::memcpy(slot(key), &value, sizeof(V));
+  }
+  /**
+   * writes elements in [first, last) at once,
+   * so that readers see all or none of them.
+   * only for the writer.
+   *
+   * exceptions:
+   *   std::out_of_range if a key exceeds limits.
+   *   std::logic_error if attached as a reader.
+   */
+  template<typename IT,
+           typename = typename std::enable_if<
+             !std::is_integral<IT>::value>::type>
+  void insert_or_assign(IT first, IT last) {
+    if (first == last) {
+      return;
+    }
+    K low = first->first;
+    K high = first->first;
+    for (IT it = first; it != last; ++it) {
+      low = it->first < low ? it->first : low;
+      high = high < it->first ? it->first : high;
+    }
+    check(low, high);
+    Write w(header);
+    expand(low, high);
+    for (; first != last; ++first) {
+      std::memcpy(slot(first->first), &first->second, sizeof(V));
+    }
+  }
+  /**
+   * expands the region of elements to contain [low, high].
+   * only for the writer.
+   *
+   * exceptions:
+   *   std::out_of_range if a key exceeds limits.
+   *   std::logic_error if attached as a reader.
+   */
+  void reserve(const K& low, const K& high) {
+    check(low, high);
+    Write w(header);
+    expand(low, high);
+  }
+  /**
+   * removes all elements. only for the writer.
+   *
+   * exceptions:
+   *   std::logic_error if attached as a reader.
+   */
+  void clear() {
+    checkWritable();
+    Write w(header);
+    if (header->size.load(std::memory_order_relaxed) != 0) {
+      std::memset(static_cast<void*>(slot(minKey())), 0,
+                  distance(minKey(), maxKey()) * sizeof(V) + sizeof(V));
+    }
+    header->size.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  /**
+   * makes the writes in its scope one change for readers.
+   */
+  class Write {
+   public:
+    explicit Write(Header* header) : h(header) {
+      const uint64_t s = h->sequence.load(std::memory_order_relaxed);
+      h->sequence.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    ~Write() {
+      h->sequence.fetch_add(1, std::memory_order_release);
+    }
+
+   private:
+    Header* h;
+  };
+  Header* header;
+  unsigned char* values;
+  size_t bytes;
+  bool writable;
+  std::string segment;
+
+  /**
+   * returns high - low without overflow.
+   */
+  static size_t distance(const K& low, const K& high) {
+    return static_cast<size_t>(static_cast<U>(U(high) - U(low)));
+  }
+  static constexpr size_t valuesOffset() {
+    return (sizeof(Header) + 63) / 64 * 64;
+  }
+  /**
+   * maps fd and closes it.
+   */
+  void map(int fd, size_t size, bool write, const std::string& name) {
+    void* p = ::mmap(nullptr, size,
+                     write ? PROT_READ | PROT_WRITE : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      throw std::system_error(error, std::generic_category(), name);
+    }
+    header = static_cast<Header*>(p);
+    values = static_cast<unsigned char*>(p) + valuesOffset();
+    bytes = size;
+    writable = write;
+    segment = name;
+  }
+  K minKey() const {
+    return header->minKey.load(std::memory_order_relaxed);
+  }
+  K maxKey() const {
+    return header->maxKey.load(std::memory_order_relaxed);
+  }
+  /**
+   * key is compared in K, so that readers never touch
+   * outside of the segment.
+   */
+  template <typename Key>
+  bool inRegion(const Key& key) const {
+    return header->size.load(std::memory_order_relaxed) != 0 &&
+      !(key < minKey()) && !(maxKey() < key);
+  }
+  unsigned char* slot(const K& key) const {
+    return values + distance(header->origin, key) * sizeof(V);
+  }
+  /**
+   * calls f until no write overlaps it, and returns its result.
+   */
+  template<typename F>
+  auto read(F f) const -> decltype(f()) {
+    for (;;) {
+      const uint64_t s = header->sequence.load(std::memory_order_acquire);
+      if ((s & 1) == 0) {
+        const auto result = f();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) == s) {
+          return result;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+  void checkWritable() const {
+    if (!writable) {
+      throw std::logic_error("attached as a reader");
+    }
+  }
+  /**
+   * checks writes of keys in [low, high] before starting them.
+   */
+  void check(const K& low, const K& high) const {
+    checkWritable();
+    if (low < header->origin) {
+      throw std::out_of_range("lower limit exceeded");
+    }
+    if (distance(header->origin, high) >= header->capacity) {
+      throw std::out_of_range("higher limit exceeded");
+    }
+  }
+  void expand(const K& low, const K& high) {
+    if (header->size.load(std::memory_order_relaxed) == 0) {
+      header->minKey.store(low, std::memory_order_relaxed);
+      header->maxKey.store(high, std::memory_order_relaxed);
+    } else {
+      if (low < minKey()) {
+        header->minKey.store(low, std::memory_order_relaxed);
+      }
+      if (maxKey() < high) {
+        header->maxKey.store(high, std::memory_order_relaxed);
+      }
+    }
+    header->size.store(distance(minKey(), maxKey()) + 1,
+                       std::memory_order_relaxed);
+  }
+};
+#endif  // SHAREDMIMICMAP_H_
@@ -0,0 +1,302 @@
+// -*- mode:c++;coding:utf-8 -*-
+// Copyright 2021 tadashi9@gmail.com
+#ifndef SPARSEMAP_H_
+#define SPARSEMAP_H_
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * the sorted associative container for sparse keys, read mostly.
+ *
+ * elements are stored in std::vector sorted by keys, and keys are
+ * copied in Eytzinger order (children of node k are 2k and 2k + 1),
+ * so that a search reads nodes of a level from the same cache lines
+ * and prefetches nodes some levels below without branches.
+ *
+ * inserting single elements keeps elements sorted but makes the index
+ * stale, and searches fall back to binary search until rebuild().
+ * insert(first, last) merges many elements and rebuilds the index once.
+ */
+template<typename K, typename V>
+class SparseMap {
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+  using reverse_iterator =
+    typename std::vector<value_type>::reverse_iterator;
+  using const_reverse_iterator =
+    typename std::vector<value_type>::const_reverse_iterator;
+  /**
+   * constructs an empty container.
+   */
+  SparseMap() : indexed(true) {}
+  /**
+   * constructs with the contents of the range [first, last).
+   */
+  template<typename IT>
+  SparseMap(IT first, IT last) : indexed(true) {
+    insert(first, last);
+  }
+  void swap(SparseMap& other) {
+    elements.swap(other.elements);
+    lines.swap(other.lines);
+    ranks.swap(other.ranks);
+    std::swap(indexed, other.indexed);
+  }
+  size_t size() const {
+    return elements.size();
+  }
+  bool empty() const {
+    return elements.empty();
+  }
+  /**
+   * reserves storage for n elements, as std::unordered_map::reserve does.
+   * unlike MimicMap::reserve(low, high), n is a count of elements,
+   * since keys between elements take no storage.
+   */
+  void reserve(size_t n) {
+    elements.reserve(n);
+  }
+  /**
+   * removes all elements.
+   */
+  void clear() {
+    elements.clear();
+    lines.clear();
+    ranks.clear();
+    indexed = true;
+  }
+  iterator begin() {
+    return elements.begin();
+  }
+  const_iterator begin() const {
+    return elements.begin();
+  }
+  const_iterator cbegin() const {
+    return elements.cbegin();
+  }
+  iterator end() {
+    return elements.end();
+  }
+  const_iterator end() const {
+    return elements.end();
+  }
+  const_iterator cend() const {
+    return elements.cend();
+  }
+  reverse_iterator rbegin() {
+    return elements.rbegin();
+  }
+  const_reverse_iterator rbegin() const {
+    return elements.rbegin();
+  }
+  const_reverse_iterator crbegin() const {
+    return elements.crbegin();
+  }
+  reverse_iterator rend() {
+    return elements.rend();
+  }
+  const_reverse_iterator rend() const {
+    return elements.rend();
+  }
+  const_reverse_iterator crend() const {
+    return elements.crend();
+  }
+  template <typename Key>
+  size_t count(const Key& key) const {
+    return contains(key) ? 1 : 0;
+  }
+  template <typename Key>
+  bool contains(const Key& key) const {
+    return find(key) != end();
+  }
+  /**
+   * returns an iterator to the first element not less than key.
+   */
+  template <typename Key>
+  iterator lower_bound(const Key& key) {
+    return begin() + position(key);
+  }
+  template <typename Key>
+  const_iterator lower_bound(const Key& key) const {
+    return begin() + position(key);
+  }
+  template <typename Key>
+  iterator find(const Key& key) {
+    const size_t i = position(key);
+    return i < size() && !(key < elements[i].first) ? begin() + i : end();
+  }
+  template <typename Key>
+  const_iterator find(const Key& key) const {
+    const size_t i = position(key);
+    return i < size() && !(key < elements[i].first) ? begin() + i : end();
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  V& at(const Key& key) {
+    const iterator it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("key not found");
+    }
+    return it->second;
+  }
+  /**
+   * access specified element with bounds checking.
+   *
+   * exceptions:
+   *   std::out_of_range if key not found.
+   */
+  template <typename Key>
+  const V& at(const Key& key) const {
+    const const_iterator it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("key not found");
+    }
+    return it->second;
+  }
+  /**
+   * access or insert specified element.
+   * inserting makes the index stale.
+   */
+  template <typename Key>
+  V& operator[](const Key& key) {
+    return findOrInsert(static_cast<K>(key)).first->second;
+  }
+  /**
+   * inserts element, or assigns its value if key exists.
+   * returns an iterator to the element and true if inserted.
+   * inserting makes the index stale.
+   */
+  std::pair<iterator, bool> insert(const value_type& value) {
+    const std::pair<iterator, bool> result = findOrInsert(value.first);
+    result.first->second = value.second;
+    return result;
+  }
+  /**
+   * inserts or assigns elements in [first, last),
+   * and rebuilds the index.
+   * the last element wins among elements of the same key.
+   */
+  template<typename IT>
+  void insert(IT first, IT last) {
+    const size_t n = size();
+    elements.insert(elements.end(), first, last);
+    const auto less = [](const value_type& a, const value_type& b) {
+      return a.first < b.first;
+    };
+    const auto same = [](const value_type& a, const value_type& b) {
+      return !(a.first < b.first) && !(b.first < a.first);
+    };
+    std::stable_sort(begin() + n, end(), less);
+    std::inplace_merge(begin(), begin() + n, end(), less);
+    // elements of the same key are in the order given,
+    // and unique() from the end keeps the last of them.
+    elements.erase(begin(), std::unique(rbegin(), rend(), same).base());
+    rebuild();
+  }
+  /**
+   * rebuilds the index after single insertions.
+   */
+  void rebuild() {
+    const size_t n = size();
+    lines.assign(n / kLineKeys + 1, Line());
+    ranks.assign(n + 1, 0);
+    fill(0, 1);
+    indexed = true;
+  }
+  /**
+   * checks whether searches use the index.
+   */
+  bool isIndexed() const {
+    return indexed;
+  }
+
+ private:
+  static constexpr size_t kLineKeys =
+    sizeof(K) < 64 ? 64 / sizeof(K) : 1;
+  /**
+   * a cache line of keys.
+   * nodes k * kLineKeys to k * kLineKeys + kLineKeys - 1,
+   * descendants of node k some levels below, share a line.
+   */
+  struct alignas(64) Line {
+    K keys[kLineKeys];
+  };
+  std::vector<value_type> elements;
+  /**
+   * keys of elements in Eytzinger order from node 1.
+   */
+  std::vector<Line> lines;
+  /**
+   * ranks[k] is the position of node k in elements.
+   */
+  std::vector<size_t> ranks;
+  bool indexed;
+
+  /**
+   * returns the element of key, inserting it if not exists.
+   */
+  std::pair<iterator, bool> findOrInsert(const K& key) {
+    const size_t i = position(key);
+    if (i < size() && !(key < elements[i].first)) {
+      return std::make_pair(begin() + i, false);
+    }
+    indexed = false;
+    return std::make_pair(elements.insert(begin() + i, value_type(key, V())),
+                          true);
+  }
+  const K* keys() const {
+    return lines.empty() ? nullptr : lines.front().keys;
+  }
+  /**
+   * fills nodes under k with elements from position i in order.
+   * returns the position next to the last filled.
+   */
+  size_t fill(size_t i, size_t k) {
+    if (k <= size()) {
+      i = fill(i, 2 * k);
+      lines[k / kLineKeys].keys[k % kLineKeys] = elements[i].first;
+      ranks[k] = i;
+      i = fill(i + 1, 2 * k + 1);
+    }
+    return i;
+  }
+  /**
+   * returns the position of the first element not less than key.
+   */
+  template <typename Key>
+  size_t position(const Key& key) const {
+    if (!indexed) {
+      return std::lower_bound(
+        begin(), end(), key,
+        [](const value_type& e, const Key& k) { return e.first < k; }) -
+        begin();
+    }
+    const size_t n = size();
+    const K* nodes = keys();
+    size_t k = 1;
+    while (k <= n) {
+      // prefetching past the end is harmless.
+      __builtin_prefetch(reinterpret_cast<const void*>(
+        reinterpret_cast<uintptr_t>(nodes) + k * sizeof(Line)));
+      k = 2 * k + (nodes[k] < key);
+    }
+    // cancels right turns after the last left turn,
+    // which went to the node of the answer.
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+    return k == 0 ? n : ranks[k];
+  }
+};
+#endif  // SPARSEMAP_H_
@@ -1,4 +1,5 @@
 #include "MimicMap.h"
+#include "SparseMap.h"
 #include <iostream>
 #include <random>
 #include <unordered_map>
@@ -32,6 +33,15 @@ void time_insert_random(M& m, T from, T to, int loop) {
   }
   std::cout << (static_cast<double>(timer.elapsed().wall) / loop);
 }
+// keeps finds from being optimized away.
+volatile size_t find_sink;
+
+template<typename M>
+void prepare_find(M&) {}
+template<typename K, typename V>
+void prepare_find(SparseMap<K, V>& m) {
+  m.rebuild();
+}
 template<typename M, typename T>
 void time_find_random(M& m, T from, T to, int loop) {
   for (T key = from; key <= to; ++key) {
@@ -39,10 +49,13 @@ void time_find_random(M& m, T from, T to, int loop) {
       p = std::make_pair(key, key);
     m.insert(p);
   }
+  prepare_find(m);
   boost::timer::cpu_timer timer;
+  size_t found = 0;
   for (int i = 0; i < loop; ++i) {
-    m.find(random_key(from, to));
+    found += m.find(random_key(from, to)) != m.end();
   }
+  find_sink = found;
   std::cout << (static_cast<double>(timer.elapsed().wall) / loop);
 }
 
@@ -154,7 +167,7 @@ int main(int argc, char* argv[]) {
     std::cerr << "find" << std::endl;
     fp = freopen("performance_find.dat", "w", stdout);
     std::cout << "# find" << std::endl;
-    std::cout << "# MimicMap unordered_map flat_map map" << std::endl;
+    std::cout << "# MimicMap unordered_map flat_map map SparseMap" << std::endl;
     for (int to : sizes) {
       std::cerr << " " << to << std::endl;
       std::cout << to << " ";
@@ -179,6 +192,11 @@ int main(int argc, char* argv[]) {
         std::map<int, int> m;
         time_find_random(m, from, to, loop);
       }
+      std::cout << " ";
+      {
+        SparseMap<int, int> m;
+        time_find_random(m, from, to, loop);
+      }
       std::cout << std::endl;
     }
     fclose(fp);